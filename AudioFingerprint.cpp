@@ -0,0 +1,144 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "VideoCapture.hpp"
+#include "AudioFingerprint.hpp"
+
+extern "C" {
+#include <libavcodec/avfft.h>
+};
+
+using namespace ph;
+using namespace std;
+
+static const double FrameSecs = 0.37;
+static const double LowFreq = 300.0;
+static const double HighFreq = 2000.0;
+
+AudioFingerprinter::AudioFingerprinter(int sample_rate):sample_rate(sample_rate){
+	int nbits = 1;
+	while ((1 << nbits) < FrameSecs*sample_rate)
+		nbits++;
+	frame_size = 1 << nbits;
+	hop = frame_size/32;
+
+	if ((rdft = av_rdft_init(nbits, DFT_R2C)) == NULL)
+		throw AudioCaptureException("unable to init rdft");
+
+	window.resize(frame_size);
+	for (int i=0;i<frame_size;i++)
+		window[i] = 0.5f - 0.5f*cosf(2.0f*(float)M_PI*i/(frame_size - 1));
+	samples.resize(frame_size);
+	spectrum.resize(frame_size);
+	prev_diffs.resize(NumberBands - 1);
+
+	// log spaced band edges, each band at least one bin wide
+	int max_bin = frame_size/2 - 1;
+	double high = min(HighFreq, 0.5*sample_rate);
+	band_edges.resize(NumberBands + 1);
+	for (int i=0;i<=NumberBands;i++){
+		double f = LowFreq*pow(high/LowFreq, (double)i/NumberBands);
+		int bin = (int)lround(f*frame_size/sample_rate);
+		if (i > 0 && bin <= band_edges[i-1]) bin = band_edges[i-1] + 1;
+		band_edges[i] = min(bin, max_bin);
+	}
+}
+
+AudioFingerprinter::~AudioFingerprinter(){
+	if (rdft != NULL)
+		av_rdft_end(rdft);
+}
+
+void AudioFingerprinter::Reset(int64_t pts){
+	nb_samples = 0;
+	next_pts = pts;
+	have_prev = false;
+}
+
+void AudioFingerprinter::ProcessFrame(vector<AudioFingerprint> &out){
+	float *x = spectrum.data();
+	const float *s = samples.data();
+	const float *w = window.data();
+	for (int i=0;i<frame_size;i++)
+		x[i] = s[i]*w[i];
+	av_rdft_calc(rdft, x);
+
+	// bin k is (x[2k], x[2k+1]) for 0 < k < frame_size/2
+	float energy[NumberBands];
+	for (int m=0;m<NumberBands;m++){
+		float e = 0;
+		for (int k=band_edges[m];k<band_edges[m+1];k++)
+			e += x[2*k]*x[2*k] + x[2*k+1]*x[2*k+1];
+		energy[m] = e;
+	}
+
+	AudioFingerprint fp;
+	fp.pts = next_pts;
+	fp.bits = 0;
+	for (int m=0;m<NumberBands-1;m++){
+		float diff = energy[m] - energy[m+1];
+		if (diff - prev_diffs[m] > 0)
+			fp.bits |= (1U << m);
+		prev_diffs[m] = diff;
+	}
+	if (have_prev)
+		out.push_back(fp);
+	have_prev = true;
+
+	memmove(samples.data(), samples.data() + hop, (frame_size - hop)*sizeof(float));
+	nb_samples -= hop;
+	next_pts += hop;
+}
+
+void AudioFingerprinter::Add(const float *buf, int n, vector<AudioFingerprint> &out){
+	while (n > 0){
+		int len = min(n, frame_size - nb_samples);
+		memcpy(samples.data() + nb_samples, buf, len*sizeof(float));
+		nb_samples += len;
+		buf += len;
+		n -= len;
+		if (nb_samples == frame_size)
+			ProcessFrame(out);
+	}
+}
+
+void AudioFingerprinter::Add(const int16_t *buf, int n, vector<AudioFingerprint> &out){
+	const float scale = 1.0f/32768.0f;
+	while (n > 0){
+		int len = min(n, frame_size - nb_samples);
+		float *dst = samples.data() + nb_samples;
+		for (int i=0;i<len;i++)
+			dst[i] = buf[i]*scale;
+		nb_samples += len;
+		buf += len;
+		n -= len;
+		if (nb_samples == frame_size)
+			ProcessFrame(out);
+	}
+}
@@ -0,0 +1,88 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#ifndef _AUDIOFINGERPRINT_H
+#define _AUDIOFINGERPRINT_H
+
+#include <cstdint>
+#include <vector>
+
+struct RDFTContext;
+
+namespace ph {
+
+/** fingerprint of one audio frame **/
+typedef struct audio_fingerprint {
+	int64_t pts;      // first sample of the frame, in 1/sample_rate units
+	uint32_t bits;    // band energy differences, one bit per band pair
+} AudioFingerprint;
+
+/** band energy fingerprints over a mono stream
+ *  Frames of ~0.37 secs (next power of two in samples), hann windowed,
+ *  overlapping by 31/32. 33 log spaced bands from 300 to 2000 Hz; bit m
+ *  is set when the energy difference of bands m and m+1 grew since the
+ *  previous frame. Spectra come from libavcodec's simd rdft.
+ **/
+class AudioFingerprinter {
+protected:
+	int sample_rate;
+	int frame_size;
+	int hop;
+	RDFTContext *rdft = NULL;
+	std::vector<float> window;
+	std::vector<float> samples;     // frame_size samples being collected
+	std::vector<float> spectrum;
+	std::vector<int> band_edges;    // first rdft bin of each band, plus end
+	std::vector<float> prev_diffs;
+	int nb_samples = 0;
+	int64_t next_pts = 0;           // pts of samples[0]
+	bool have_prev = false;
+
+	void ProcessFrame(std::vector<AudioFingerprint> &out);
+
+public:
+	static const int NumberBands = 33;
+
+	/** @throws AudioCaptureException when the rdft cannot be set up **/
+	AudioFingerprinter(int sample_rate);
+	~AudioFingerprinter();
+	AudioFingerprinter(const AudioFingerprinter&) = delete;
+	AudioFingerprinter& operator=(const AudioFingerprinter&) = delete;
+
+	/** start over at pts, in 1/sample_rate units **/
+	void Reset(int64_t pts = 0);
+
+	/** append samples, adding a record to out for each completed frame **/
+	void Add(const float *buf, int n, std::vector<AudioFingerprint> &out);
+	void Add(const int16_t *buf, int n, std::vector<AudioFingerprint> &out);
+
+	int FrameSize() const { return frame_size; }
+	int HopSize() const { return hop; }
+};
+
+} //namespace ph
+
+#endif
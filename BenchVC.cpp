@@ -0,0 +1,383 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "VideoCapture.hpp"
+#include "TestFixture.hpp"
+
+extern "C" {
+#include <libavfilter/buffersink.h>
+#include <libavutil/avutil.h>
+#include <libavutil/cpu.h>
+};
+
+using namespace std;
+
+/* cpu seconds (user + sys) for RUSAGE_SELF or RUSAGE_THREAD */
+double cpu_seconds(int who){
+	struct rusage ru;
+	getrusage(who, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+		+ (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec)/1000000.0;
+}
+
+/* pull all video frames
+ * spin mode polls with TryPullVideoFrame, the way PullVideoFrame used to behave */
+void consume_video(ph::VideoCapture *vc, bool spin, long &count, double &cpu){
+	AVFrame *frame = NULL;
+	int rc;
+	count = 0;
+	while (true){
+		if (spin){
+			rc = vc->TryPullVideoFrame(frame);
+			if (rc == AVERROR(EAGAIN)) continue;
+		} else {
+			rc = vc->PullVideoFrame(frame, -1);
+		}
+		if (rc < 0) break;
+		count++;
+		av_frame_free(&frame);
+	}
+	cpu = cpu_seconds(RUSAGE_THREAD);
+}
+
+/* ---- benchmark suite over generated fixtures ---- */
+
+typedef struct bench_mode {
+	const char *name;
+	int flag;
+	int pix_fmt;
+	int flt_fmt;
+} BenchMode;
+
+/* sent from the measuring child process, so plain data only */
+typedef struct bench_result {
+	bool ok;
+	char error[128];
+	long frames;
+	long hashes;
+	long samples;
+	long fingerprints;
+	uint64_t dropped;
+	double wall_secs;
+	double cpu_secs;
+	long peak_rss_kb;
+	double read_secs;
+	double decode_secs;
+	double filter_secs;
+} BenchResult;
+
+static const BenchMode bench_modes[] = {
+	{ "video", PHCAPTURE_VIDEO_FLAG, PHPIXFMT_YUV444P, PHAUDIO_FLT_FMT },
+	{ "video_gray8", PHCAPTURE_VIDEO_FLAG, PHPIXFMT_GRAY8, PHAUDIO_FLT_FMT },
+	{ "video_source", PHCAPTURE_VIDEO_FLAG, PHPIXFMT_SOURCE, PHAUDIO_FLT_FMT },
+	{ "video_pipeline", PHCAPTURE_VIDEO_FLAG|PHCAPTURE_PIPELINE_FLAG, PHPIXFMT_YUV444P, PHAUDIO_FLT_FMT },
+	{ "video_keyframe", PHCAPTURE_VIDEO_FLAG|PHCAPTURE_KEYFRAME_FLAG, PHPIXFMT_YUV444P, PHAUDIO_FLT_FMT },
+	{ "video_hashonly", PHCAPTURE_VIDEO_FLAG|PHCAPTURE_HASHONLY_FLAG, PHPIXFMT_YUV444P, PHAUDIO_FLT_FMT },
+	{ "audio_s16", PHCAPTURE_AUDIO_FLAG, PHPIXFMT_YUV444P, PHAUDIO_S16_FMT },
+	{ "audio_flt", PHCAPTURE_AUDIO_FLAG, PHPIXFMT_YUV444P, PHAUDIO_FLT_FMT },
+	{ "audio_fponly", PHCAPTURE_AUDIO_FLAG|PHCAPTURE_AUDIOFPONLY_FLAG, PHPIXFMT_YUV444P, PHAUDIO_FLT_FMT },
+	{ "videoaudio_pipeline", PHCAPTURE_VIDEOAUDIO_FLAG|PHCAPTURE_PIPELINE_FLAG, PHPIXFMT_YUV444P, PHAUDIO_FLT_FMT }
+};
+
+/* capture a whole file in this process, draining every output the mode enables */
+static void measure(const string &path, const BenchMode &mode, BenchResult &res){
+	ph::CaptureOptions opts;
+	opts.flag = mode.flag;
+	opts.pix_fmt = mode.pix_fmt;
+	opts.flt_fmt = mode.flt_fmt;
+	auto t0 = chrono::steady_clock::now();
+	try {
+		ph::VideoCapture vc(path, opts);
+		vector<thread> consumers;
+		if ((mode.flag & PHCAPTURE_VIDEO_FLAG) && !(mode.flag & PHCAPTURE_HASHONLY_FLAG)){
+			consumers.push_back(thread([&]{
+						AVFrame *frame;
+						while (vc.PullPooledVideoFrame(frame) == 0){
+							vc.ReleaseVideoFrame(frame);
+							res.frames++;
+						}
+					}));
+		}
+		if (mode.flag & (PHCAPTURE_HASH_FLAG|PHCAPTURE_HASHONLY_FLAG)){
+			consumers.push_back(thread([&]{
+						ph::HashRecord rec;
+						while (vc.PullFrameHash(rec) == 0)
+							res.hashes++;
+					}));
+		}
+		if ((mode.flag & PHCAPTURE_AUDIO_FLAG) && !(mode.flag & PHCAPTURE_AUDIOFPONLY_FLAG)){
+			consumers.push_back(thread([&]{
+						const int N = 4096;
+						int n;
+						if (mode.flt_fmt){
+							vector<float> buf(N);
+							while ((n = vc.PullAudioSamples(buf.data(), N)) > 0)
+								res.samples += n;
+						} else {
+							vector<int16_t> buf(N);
+							while ((n = vc.PullAudioSamples(buf.data(), N)) > 0)
+								res.samples += n;
+						}
+					}));
+		}
+		if (mode.flag & (PHCAPTURE_AUDIOFP_FLAG|PHCAPTURE_AUDIOFPONLY_FLAG)){
+			consumers.push_back(thread([&]{
+						ph::AudioFingerprint fp;
+						while (vc.PullAudioFingerprint(fp) == 0)
+							res.fingerprints++;
+					}));
+		}
+		try {
+			vc.Process();
+		} catch (...){
+			for (thread &thr : consumers) thr.join();
+			throw;
+		}
+		for (thread &thr : consumers) thr.join();
+
+		ph::CaptureStats stats = vc.GetStats();
+		res.dropped = stats.video_frames_dropped;
+		res.read_secs = stats.read_secs;
+		res.decode_secs = stats.video_decode_secs + stats.audio_decode_secs;
+		res.filter_secs = stats.video_filter_secs + stats.audio_filter_secs;
+		res.ok = true;
+	} catch (std::exception &ex){
+		snprintf(res.error, sizeof(res.error), "%s", ex.what());
+	}
+	res.wall_secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	res.cpu_secs = cpu_seconds(RUSAGE_SELF);
+	res.peak_rss_kb = ru.ru_maxrss;
+}
+
+/* measure in a child process so cpu time and peak rss are the capture's own */
+static void run_case(const string &path, const BenchMode &mode, BenchResult &res){
+	memset(&res, 0, sizeof(res));
+	int fds[2];
+	if (pipe(fds) < 0){
+		snprintf(res.error, sizeof(res.error), "pipe: %s", strerror(errno));
+		return;
+	}
+	pid_t pid = fork();
+	if (pid < 0){
+		snprintf(res.error, sizeof(res.error), "fork: %s", strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		return;
+	}
+	if (pid == 0){
+		close(fds[0]);
+		BenchResult r;
+		memset(&r, 0, sizeof(r));
+		measure(path, mode, r);
+		const char *p = (const char*)&r;
+		size_t left = sizeof(r);
+		while (left > 0){
+			ssize_t n = write(fds[1], p, left);
+			if (n <= 0) break;
+			p += n;
+			left -= n;
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+	char *p = (char*)&res;
+	size_t got = 0;
+	while (got < sizeof(res)){
+		ssize_t n = read(fds[0], p + got, sizeof(res) - got);
+		if (n <= 0) break;
+		got += n;
+	}
+	close(fds[0]);
+	int status = 0;
+	waitpid(pid, &status, 0);
+	if (got != sizeof(res)){
+		memset(&res, 0, sizeof(res));
+		snprintf(res.error, sizeof(res.error), "capture process died, status %d", status);
+	}
+}
+
+static string json_escape(const char *str){
+	string out;
+	for (const char *c=str;*c;c++){
+		if (*c == '"' || *c == '\\') out += '\\';
+		if ((unsigned char)*c < 0x20) continue;
+		out += *c;
+	}
+	return out;
+}
+
+static int run_suite(const string &dir, const string &json_path, bool quick){
+	const int sizes[][2] = { {640, 480}, {1280, 720}, {1920, 1080}, {3840, 2160} };
+	const FixtureSpec codecs[] = { { "h264", AV_CODEC_ID_H264, 0, 0, false },
+								   { "mpeg4", AV_CODEC_ID_MPEG4, 0, 0, false },
+								   { "mjpeg", AV_CODEC_ID_MJPEG, 0, 0, false } };
+	av_log_set_level(AV_LOG_ERROR);
+	if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST){
+		cerr << "unable to create " << dir << ": " << strerror(errno) << endl;
+		return 1;
+	}
+
+	// fixtures are deterministic, so ones left from an earlier run are reused
+	vector<FixtureSpec> fixtures;
+	vector<bool> available;
+	for (const FixtureSpec &codec : codecs){
+		for (const auto &size : sizes){
+			for (int interlaced=0;interlaced<2;interlaced++){
+				if (quick && (size[1] > 1080 || (interlaced && size[1] != 1080))) continue;
+				FixtureSpec spec = codec;
+				spec.width = size[0];
+				spec.height = size[1];
+				spec.interlaced = interlaced != 0;
+				string path = dir + "/" + fixture_name(spec) + ".mkv";
+				bool ok = access(path.c_str(), R_OK) == 0;
+				if (!ok){
+					cout << "generate " << path << endl;
+					ok = make_fixture(spec, path);
+					if (!ok) cout << "  skipped: no encoder or unable to write" << endl;
+				}
+				fixtures.push_back(spec);
+				available.push_back(ok);
+			}
+		}
+	}
+
+	FILE *json = fopen(json_path.c_str(), "w");
+	if (json == NULL){
+		cerr << "unable to open " << json_path << ": " << strerror(errno) << endl;
+		return 1;
+	}
+	char date[32];
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+	fprintf(json, "{\n  \"date\": \"%s\",\n  \"ffmpeg\": \"%s\",\n  \"cpus\": %d,\n",
+			date, json_escape(av_version_info()).c_str(), av_cpu_count());
+	fprintf(json, "  \"fixture_secs\": %g,\n  \"results\": [", FixtureSecs);
+
+	bool first = true;
+	for (size_t i=0;i<fixtures.size();i++){
+		const FixtureSpec &spec = fixtures[i];
+		string name = fixture_name(spec);
+		string path = dir + "/" + name + ".mkv";
+		for (const BenchMode &mode : bench_modes){
+			BenchResult res;
+			if (available[i]){
+				run_case(path, mode, res);
+			} else {
+				memset(&res, 0, sizeof(res));
+				snprintf(res.error, sizeof(res.error), "fixture not available");
+			}
+			double fps = (res.wall_secs > 0) ? res.frames/res.wall_secs : 0;
+			double sps = (res.wall_secs > 0) ? res.samples/res.wall_secs : 0;
+			cout << name << " " << mode.name << ": "
+				 << ((res.ok) ? "" : res.error) << " " << fps << " fps "
+				 << sps << " samples/s " << res.cpu_secs << " cpu secs "
+				 << res.peak_rss_kb << " kB" << endl;
+
+			fprintf(json, "%s\n    {\"fixture\": \"%s\", \"codec\": \"%s\", \"width\": %d, \"height\": %d, "
+					"\"interlaced\": %s, \"mode\": \"%s\", \"ok\": %s, \"error\": \"%s\",\n"
+					"     \"frames\": %ld, \"hashes\": %ld, \"samples\": %ld, \"fingerprints\": %ld, "
+					"\"dropped\": %llu,\n"
+					"     \"wall_secs\": %.6f, \"cpu_secs\": %.6f, \"frames_per_sec\": %.3f, "
+					"\"samples_per_sec\": %.1f, \"peak_rss_kb\": %ld,\n"
+					"     \"read_secs\": %.6f, \"decode_secs\": %.6f, \"filter_secs\": %.6f}",
+					(first) ? "" : ",", name.c_str(), spec.codec, spec.width, spec.height,
+					(spec.interlaced) ? "true" : "false", mode.name, (res.ok) ? "true" : "false",
+					json_escape(res.error).c_str(),
+					res.frames, res.hashes, res.samples, res.fingerprints, (unsigned long long)res.dropped,
+					res.wall_secs, res.cpu_secs, fps, sps, res.peak_rss_kb,
+					res.read_secs, res.decode_secs, res.filter_secs);
+			first = false;
+		}
+	}
+	fprintf(json, "\n  ]\n}\n");
+	fclose(json);
+	cout << "results written to " << json_path << endl;
+	return 0;
+}
+
+int main(int argc, char **argv){
+	if (argc < 2){
+		cout << "not enough args." << endl;
+		cout << "usage: prog filename [block|spin] [serial|pipeline]" << endl;
+		cout << "       prog --suite [fixture_dir] [json_file] [quick]" << endl;
+		return 0;
+	}
+	if (string(argv[1]) == "--suite"){
+		const string dir = (argc > 2) ? argv[2] : "bench-fixtures";
+		const string json = (argc > 3) ? argv[3] : "bench.json";
+		const bool quick = (argc > 4 && string(argv[4]) == "quick");
+		return run_suite(dir, json, quick);
+	}
+	const string filename = argv[1];
+	const bool spin = (argc > 2 && string(argv[2]) == "spin");
+	const bool pipeline = (argc > 3 && string(argv[3]) == "pipeline");
+	int flag = PHCAPTURE_VIDEO_FLAG;
+	if (pipeline) flag |= PHCAPTURE_PIPELINE_FLAG;
+
+	try {
+		ph::VideoCapture vc(filename, 0, 0, 0, 0, 8000, 256, flag);
+
+		long nbframes = 0;
+		double consumer_cpu = 0;
+		double cpu0 = cpu_seconds(RUSAGE_SELF);
+		auto t0 = chrono::steady_clock::now();
+
+		thread video_thr(consume_video, &vc, spin, ref(nbframes), ref(consumer_cpu));
+		vc.Process();
+		video_thr.join();
+
+		double wall = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		double cpu = cpu_seconds(RUSAGE_SELF) - cpu0;
+
+		cout << "mode: " << (spin ? "spin" : "block") << (pipeline ? " pipeline" : " serial") << endl;
+		cout << "frames: " << nbframes << endl;
+		cout << "wall secs: " << wall << endl;
+		cout << "cpu secs: " << cpu << endl;
+		cout << "consumer cpu secs: " << consumer_cpu << endl;
+		if (nbframes > 0)
+			cout << "cpu secs/frame: " << cpu/nbframes << endl;
+	} catch (ph::VideoCaptureException &ex){
+		cout << "vc error: " << ex.what() << endl;
+	}
+	return 0;
+}
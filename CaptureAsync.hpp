@@ -0,0 +1,170 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#ifndef _CAPTUREASYNC_H
+#define _CAPTUREASYNC_H
+
+/* C++20 coroutine interface; empty for earlier standards */
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <utility>
+#include "VideoCapture.hpp"
+
+namespace ph {
+
+/** resumes a coroutine handed over by the producer thread, e.g. by
+ *  posting it to an event loop; empty to resume on the producer thread
+ **/
+typedef std::function<void(std::coroutine_handle<>)> Resumer;
+
+/** awaitable for the next queued video frame
+ *  Does not block a thread: a coroutine that finds the queue empty is
+ *  suspended and resumed once Process() queues a frame or ends.
+ *  One awaiting coroutine per capture at a time.
+ *
+ *  e.g. while (VideoFrame f = co_await NextFrame(vc, post)) { ... }
+ **/
+class FrameAwaiter {
+protected:
+	VideoCapture &capture;
+	Resumer resumer;
+
+public:
+	FrameAwaiter(VideoCapture &capture, Resumer resumer):capture(capture),resumer(std::move(resumer)){}
+
+	bool await_ready(){
+		return false;
+	}
+
+	/** suspends unless a frame or the end of stream is already there **/
+	bool await_suspend(std::coroutine_handle<> h){
+		Resumer r = resumer;
+		return capture.NotifyVideoReady([h, r]{
+				if (r) r(h);
+				else h.resume();
+			});
+	}
+
+	/** @return the frame, empty at end of stream **/
+	VideoFrame await_resume(){
+		VideoFrame frame;
+		capture.PullVideoFrame(frame, 0);
+		return frame;
+	}
+};
+
+inline FrameAwaiter NextFrame(VideoCapture &capture, Resumer resumer = Resumer()){
+	return FrameAwaiter(capture, std::move(resumer));
+}
+
+/** minimal lazy generator, single pass **/
+template<typename T>
+class Generator {
+public:
+	struct promise_type {
+		T value{};
+		std::exception_ptr ex;
+
+		Generator get_return_object(){
+			return Generator(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		std::suspend_always yield_value(T v){
+			value = v;
+			return {};
+		}
+		void return_void(){}
+		void unhandled_exception(){
+			ex = std::current_exception();
+		}
+	};
+
+	class iterator {
+	protected:
+		std::coroutine_handle<promise_type> h;
+	public:
+		explicit iterator(std::coroutine_handle<promise_type> h = nullptr):h(h){}
+		iterator& operator++(){
+			h.resume();
+			if (h.promise().ex) std::rethrow_exception(h.promise().ex);
+			return *this;
+		}
+		T operator*() const { return h.promise().value; }
+		bool operator==(std::default_sentinel_t) const { return !h || h.done(); }
+		bool operator!=(std::default_sentinel_t s) const { return !(*this == s); }
+	};
+
+	explicit Generator(std::coroutine_handle<promise_type> h):h(h){}
+	Generator(Generator &&other):h(other.h){
+		other.h = nullptr;
+	}
+	Generator(const Generator&) = delete;
+	Generator& operator=(const Generator&) = delete;
+	~Generator(){
+		if (h) h.destroy();
+	}
+
+	/** runs to the first value **/
+	iterator begin(){
+		h.resume();
+		if (h.promise().ex) std::rethrow_exception(h.promise().ex);
+		return iterator(h);
+	}
+	std::default_sentinel_t end(){ return {}; }
+
+protected:
+	std::coroutine_handle<promise_type> h;
+};
+
+/** frames decoded on demand by NextVideoFrame(), in the iterating thread
+ *  Each frame is valid until the iterator advances.
+ *  @throws VideoCaptureException from the loop that iterates
+ *
+ *  e.g. for (AVFrame *frame : VideoFrames(vc)) { ... }
+ **/
+inline Generator<AVFrame*> VideoFrames(VideoCapture &capture){
+	// freed also when the generator is dropped mid-stream
+	struct frame_guard {
+		AVFrame *frame = av_frame_alloc();
+		~frame_guard(){ av_frame_free(&frame); }
+	} guard;
+	if (guard.frame == NULL)
+		throw VideoCaptureException("unable to allocate frame");
+	while (capture.NextVideoFrame(guard.frame) == 0){
+		co_yield guard.frame;
+		av_frame_unref(guard.frame);
+	}
+}
+
+} //namespace ph
+
+#endif /* __cpp_impl_coroutine */
+
+#endif
@@ -0,0 +1,162 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#include <thread>
+#include "CaptureScheduler.hpp"
+
+extern "C" {
+#include <libavutil/cpu.h>
+};
+
+using namespace ph;
+using namespace std;
+
+static int64_t now_ns(){
+	return chrono::duration_cast<chrono::nanoseconds>(
+		chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CaptureScheduler::CaptureScheduler(int core_budget, int threads_per_capture)
+	:core_budget((core_budget > 0) ? core_budget : av_cpu_count()),
+	 threads_per_capture((threads_per_capture > 0) ? threads_per_capture : 1),
+	 next_job(0), files_done(0), files_failed(0), video_frames(0), audio_samples(0),
+	 start_ns(0), end_ns(0), running(false){
+}
+
+void CaptureScheduler::SetCallbacks(const CaptureCallbacks &cb){
+	callbacks = cb;
+}
+
+size_t CaptureScheduler::Add(const string &filename, const CaptureOptions &opts){
+	CaptureJob job;
+	job.filename = filename;
+	job.options = opts;
+	// nothing drains the hash and fingerprint queues; Process() would block on them
+	job.options.flag &= ~(PHCAPTURE_HASH_FLAG|PHCAPTURE_HASHONLY_FLAG
+						  |PHCAPTURE_AUDIOFP_FLAG|PHCAPTURE_AUDIOFPONLY_FLAG);
+	// one decode thread per job; stream workers and segments would exceed the budget
+	job.options.flag &= ~PHCAPTURE_PIPELINE_FLAG;
+	job.options.segment_threads = 0;
+	if (job.options.video_threads <= 0)
+		job.options.video_threads = threads_per_capture;
+	jobs.push_back(job);
+	return jobs.size() - 1;
+}
+
+int CaptureScheduler::GetConcurrency() const {
+	int n = core_budget/threads_per_capture;
+	return (n > 0) ? n : 1;
+}
+
+void CaptureScheduler::Run(){
+	next_job = 0;
+	files_done = 0;
+	files_failed = 0;
+	video_frames = 0;
+	audio_samples = 0;
+	start_ns = now_ns();
+	running = true;
+	VideoCapture::SetCoreBudget(core_budget);
+
+	int nb_workers = GetConcurrency();
+	if ((size_t)nb_workers > jobs.size()) nb_workers = (int)jobs.size();
+	vector<thread> workers;
+	for (int i=0;i<nb_workers;i++)
+		workers.push_back(thread(&CaptureScheduler::RunWorker, this));
+	for (thread &thr : workers)
+		thr.join();
+	end_ns = now_ns();
+	running = false;
+}
+
+void CaptureScheduler::RunWorker(){
+	size_t id;
+	while ((id = next_job++) < jobs.size())
+		RunJob(id);
+}
+
+void CaptureScheduler::RunJob(size_t id){
+	const CaptureJob &job = jobs[id];
+	string error;
+	try {
+		VideoCapture vc(job.filename, job.options);
+
+		// delivered inline on the decode thread; nothing is queued
+		vc.OnVideoFrame([&](const AVFrame *frame){
+				if (callbacks.on_video_frame) callbacks.on_video_frame(id, frame);
+				video_frames++;
+			});
+		vc.OnAudioSamples([&](const AVFrame *frame){
+				if (job.options.flt_fmt){
+					if (callbacks.on_audio_flt)
+						callbacks.on_audio_flt(id, (const float*)frame->data[0], frame->nb_samples);
+				} else {
+					if (callbacks.on_audio_s16)
+						callbacks.on_audio_s16(id, (const int16_t*)frame->data[0], frame->nb_samples);
+				}
+				audio_samples += frame->nb_samples;
+			});
+		vc.OnSubtitle([&](const AVSubtitle *sub){
+				if (callbacks.on_subtitle) callbacks.on_subtitle(id, sub);
+			});
+		// may replace the callbacks above
+		if (callbacks.on_start) callbacks.on_start(id, vc);
+		vc.Process();
+	} catch (VideoCaptureException &ex){
+		error = ex.what();
+	} catch (AudioCaptureException &ex){
+		error = ex.what();
+	} catch (exception &ex){
+		// e.g. bad_alloc, or thrown by a callback
+		error = ex.what();
+		if (error.empty()) error = "unknown error";
+	} catch (...){
+		error = "unknown error";
+	}
+
+	if (error.empty())
+		files_done++;
+	else
+		files_failed++;
+	if (callbacks.on_done) callbacks.on_done(id, error);
+}
+
+SchedulerStats CaptureScheduler::GetStats(){
+	SchedulerStats stats;
+	stats.files_done = files_done.load();
+	stats.files_failed = files_failed.load();
+	stats.video_frames = video_frames.load();
+	stats.audio_samples = audio_samples.load();
+	int64_t start = start_ns.load();
+	int64_t end = (running.load()) ? now_ns() : end_ns.load();
+	if (end > start)
+		stats.elapsed_secs = (end - start)/1e9;
+	if (stats.elapsed_secs > 0){
+		stats.files_per_sec = (stats.files_done + stats.files_failed)/stats.elapsed_secs;
+		stats.frames_per_sec = stats.video_frames/stats.elapsed_secs;
+	}
+	return stats;
+}
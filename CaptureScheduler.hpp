@@ -0,0 +1,125 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#ifndef _CAPTURESCHEDULER_H
+#define _CAPTURESCHEDULER_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include "VideoCapture.hpp"
+
+namespace ph {
+
+typedef struct capture_job {
+	string filename;
+	CaptureOptions options;
+} CaptureJob;
+
+/** callbacks invoked from scheduler threads
+ *  frames, samples and subtitles are borrowed for the duration of the call,
+ *  and are delivered inline on the capture's decode thread(s).
+ *  callbacks for different files run concurrently; an exception thrown
+ *  from one other than on_done fails its file, reported to on_done.
+ *  on_start runs before Process(), after the scheduler's own frame, sample
+ *  and subtitle callbacks are set on vc, so it may replace them.
+ **/
+typedef struct capture_callbacks {
+	function<void(size_t job, VideoCapture &vc)> on_start;
+	function<void(size_t job, const AVFrame *frame)> on_video_frame;
+	function<void(size_t job, const int16_t *samples, int nb_samples)> on_audio_s16;
+	function<void(size_t job, const float *samples, int nb_samples)> on_audio_flt;
+	function<void(size_t job, const AVSubtitle *sub)> on_subtitle;
+	function<void(size_t job, const string &error)> on_done;   // error empty on success
+} CaptureCallbacks;
+
+typedef struct scheduler_stats {
+	uint64_t files_done = 0;
+	uint64_t files_failed = 0;
+	uint64_t video_frames = 0;
+	uint64_t audio_samples = 0;
+	double elapsed_secs = 0;
+	double files_per_sec = 0;
+	double frames_per_sec = 0;
+} SchedulerStats;
+
+/** runs queued captures concurrently within a core budget
+ *  Each capture's video decoder gets threads_per_capture threads, and
+ *  core_budget/threads_per_capture captures run at a time.
+ **/
+class CaptureScheduler {
+protected:
+	vector<CaptureJob> jobs;
+	CaptureCallbacks callbacks;
+	int core_budget;
+	int threads_per_capture;
+
+	atomic_size_t next_job;
+	atomic_ullong files_done;
+	atomic_ullong files_failed;
+	atomic_ullong video_frames;
+	atomic_ullong audio_samples;
+	atomic<int64_t> start_ns;   // steady clock, read by GetStats() during Run()
+	atomic<int64_t> end_ns;
+	atomic_bool running;
+
+	void RunWorker();
+	void RunJob(size_t id);
+
+public:
+	/** ctor
+	 * @param core_budget          total cores for all captures, 0 for all cpus
+	 * @param threads_per_capture  video decoder threads per capture
+	 **/
+	CaptureScheduler(int core_budget = 0, int threads_per_capture = 1);
+
+	void SetCallbacks(const CaptureCallbacks &cb);
+
+	/** queue a file
+	 *  options video_threads is replaced by threads_per_capture unless
+	 *  set to an explicit count; hash, fingerprint and pipeline flags
+	 *  and segment_threads are dropped
+	 *  @return job id passed to callbacks
+	 **/
+	size_t Add(const string &filename, const CaptureOptions &opts = CaptureOptions());
+
+	/** process all queued files; returns when every file is done
+	 *  sets VideoCapture::SetCoreBudget() to the scheduler's core budget
+	 **/
+	void Run();
+
+	/** no. captures running at a time **/
+	int GetConcurrency() const;
+
+	/** aggregate throughput; safe to call from another thread during Run() **/
+	SchedulerStats GetStats();
+};
+
+} //namespace ph
+
+#endif
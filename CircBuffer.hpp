@@ -0,0 +1,234 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#ifndef _CIRCBUFFER_H
+#define _CIRCBUFFER_H
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "circ_buf.h"
+
+namespace ph {
+
+const int CacheLineSize = 64;
+
+/** contiguous run of samples inside a CircBuffer, not owned **/
+template<typename T>
+struct SampleSpan {
+	const T *data = NULL;
+	unsigned long len = 0;
+};
+
+/** single producer/single consumer circular buffer of samples
+ *  head is only written by the producer, tail only by the consumer,
+ *  each on its own cache line.  Transfers are at most two memcpy spans.
+ *  A side that cannot make progress parks on a condition variable
+ *  rather than spinning.
+ *  size must be a power of 2
+ **/
+template<typename T>
+class CircBuffer {
+protected:
+	T *samples;
+	const unsigned long size;
+
+	/* padding keeps head and tail a full cache line apart without
+	 * requiring over-aligned new */
+	char pad0[CacheLineSize];
+	std::atomic_ulong head;
+	char pad1[CacheLineSize - sizeof(std::atomic_ulong)];
+	std::atomic_ulong tail;
+	char pad2[CacheLineSize - sizeof(std::atomic_ulong)];
+
+	std::atomic_bool closed;
+	std::atomic_int waiters;
+	std::mutex park_mtx;
+	std::condition_variable park_cond;
+
+	/* sleep until pred holds; pred re-checked under park_mtx */
+	template<typename Pred>
+	void Park(Pred pred){
+		std::unique_lock<std::mutex> lck(park_mtx);
+		waiters.fetch_add(1, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		park_cond.wait(lck, pred);
+		waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	/* wake other side if it is parked; call after publishing head or tail */
+	void Wake(){
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiters.load(std::memory_order_relaxed) > 0){
+			std::lock_guard<std::mutex> lck(park_mtx);
+			park_cond.notify_all();
+		}
+	}
+
+public:
+	CircBuffer(unsigned long size):samples(new T[size]),size(size){
+		Reset();
+	}
+
+	~CircBuffer(){
+		delete[] samples;
+	}
+
+	CircBuffer(const CircBuffer&) = delete;
+	CircBuffer& operator=(const CircBuffer&) = delete;
+
+	/** empty buffer and reopen; not safe while producer or consumer active **/
+	void Reset(){
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+		waiters.store(0, std::memory_order_relaxed);
+		closed.store(false, std::memory_order_release);
+	}
+
+	/** producer: write n samples, parking while buffer is full
+	 *  @return no. samples written, less than n only if buffer closed
+	 **/
+	unsigned long Write(const T *src, unsigned long n){
+		unsigned long written = 0;
+		unsigned long h = head.load(std::memory_order_relaxed);
+		while (written < n && !closed.load(std::memory_order_acquire)){
+			unsigned long t = tail.load(std::memory_order_acquire);
+			unsigned long space = CIRC_SPACE(h, t, size);
+			if (space == 0){
+				Park([this, h]{
+						return CIRC_SPACE(h, tail.load(std::memory_order_acquire), size) > 0
+							|| closed.load(std::memory_order_acquire);
+					});
+				continue;
+			}
+			unsigned long len = (n - written < space) ? n - written : space;
+			unsigned long first = CIRC_SPACE_TO_END(h, t, size);
+			if (first > len) first = len;
+			memcpy(samples + h, src + written, first*sizeof(T));
+			memcpy(samples, src + written + first, (len - first)*sizeof(T));
+			h = (h + len) & (size - 1);
+			written += len;
+			head.store(h, std::memory_order_release);
+			Wake();
+		}
+		return written;
+	}
+
+	/** consumer: read up to n samples, parking until n samples are
+	 *  available or the buffer is closed
+	 *  @return no. samples read, 0 once closed and drained
+	 **/
+	unsigned long Read(T *dst, unsigned long n){
+		unsigned long nread = 0;
+		unsigned long t = tail.load(std::memory_order_relaxed);
+		while (nread < n){
+			bool eos = closed.load(std::memory_order_acquire);
+			unsigned long h = head.load(std::memory_order_acquire);
+			unsigned long cnt = CIRC_CNT(h, t, size);
+			if (cnt == 0){
+				if (eos) break;
+				Park([this, t]{
+						return CIRC_CNT(head.load(std::memory_order_acquire), t, size) > 0
+							|| closed.load(std::memory_order_acquire);
+					});
+				continue;
+			}
+			unsigned long len = (n - nread < cnt) ? n - nread : cnt;
+			unsigned long first = CIRC_CNT_TO_END(h, t, size);
+			if (first > len) first = len;
+			memcpy(dst + nread, samples + t, first*sizeof(T));
+			memcpy(dst + nread + first, samples, (len - first)*sizeof(T));
+			t = (t + len) & (size - 1);
+			nread += len;
+			tail.store(t, std::memory_order_release);
+			Wake();
+		}
+		return nread;
+	}
+
+	/** consumer: expose readable samples in place, parking until at least
+	 *  min_count (at most size - 1) are available or the buffer is closed
+	 *  The region is split at the wrap point, so second is empty unless
+	 *  it wraps. Samples stay valid until passed to Commit().
+	 *  @return no. samples in first and second, 0 once closed and drained
+	 **/
+	unsigned long Peek(SampleSpan<T> &first, SampleSpan<T> &second, unsigned long min_count = 1){
+		unsigned long t = tail.load(std::memory_order_relaxed);
+		if (min_count > size - 1) min_count = size - 1;
+		if (min_count == 0) min_count = 1;
+		unsigned long h = head.load(std::memory_order_acquire);
+		if (CIRC_CNT(h, t, size) < min_count && !closed.load(std::memory_order_acquire)){
+			Park([this, t, min_count]{
+					return CIRC_CNT(head.load(std::memory_order_acquire), t, size) >= min_count
+						|| closed.load(std::memory_order_acquire);
+				});
+			h = head.load(std::memory_order_acquire);
+		}
+		unsigned long cnt = CIRC_CNT(h, t, size);
+		unsigned long to_end = CIRC_CNT_TO_END(h, t, size);
+		first.data = samples + t;
+		first.len = to_end;
+		second.data = samples;
+		second.len = cnt - to_end;
+		return cnt;
+	}
+
+	/** consumer: release the first n samples returned by Peek() to the producer
+	 *  n is clamped to the samples available, so tail never passes head
+	 *  @return no. samples released
+	 **/
+	unsigned long Commit(unsigned long n){
+		unsigned long t = tail.load(std::memory_order_relaxed);
+		unsigned long cnt = CIRC_CNT(head.load(std::memory_order_acquire), t, size);
+		if (n > cnt) n = cnt;
+		tail.store((t + n) & (size - 1), std::memory_order_release);
+		Wake();
+		return n;
+	}
+
+	/** mark end of stream: consumer drains what remains, producer stops writing **/
+	void Close(){
+		closed.store(true, std::memory_order_release);
+		std::lock_guard<std::mutex> lck(park_mtx);
+		park_cond.notify_all();
+	}
+
+	/** no. samples ready to read **/
+	unsigned long Count() const {
+		return CIRC_CNT(head.load(std::memory_order_acquire),
+						tail.load(std::memory_order_acquire), size);
+	}
+
+	unsigned long Size() const {
+		return size;
+	}
+};
+
+} //namespace ph
+
+#endif
@@ -0,0 +1,153 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#ifndef _FRAMEPOOL_H
+#define _FRAMEPOOL_H
+
+#include <vector>
+#include <new>
+#include "MessageQueue.hpp"
+
+extern "C" {
+#include <libavutil/frame.h>
+};
+
+namespace ph {
+
+/** fixed set of preallocated AVFrames
+ *  Acquire blocks while every frame is out, which throttles the
+ *  producer to the pace of the consumers.
+ **/
+class FramePool {
+protected:
+	std::vector<AVFrame*> frames;
+	MessageQueue<AVFrame*> free_frames;
+
+public:
+	FramePool(int size):free_frames(size){
+		for (int i=0;i<size;i++){
+			AVFrame *frame = av_frame_alloc();
+			if (frame == NULL){
+				for (AVFrame *f : frames) av_frame_free(&f);
+				throw std::bad_alloc();
+			}
+			frames.push_back(frame);
+			free_frames.Send(frame, 0);
+		}
+	}
+
+	~FramePool(){
+		for (AVFrame *f : frames) av_frame_free(&f);
+	}
+
+	FramePool(const FramePool&) = delete;
+	FramePool& operator=(const FramePool&) = delete;
+
+	/** get an empty frame
+	 *  @param timeout_ms neg. to wait for a frame to be released, 0 for none
+	 *  @return 0 on success, AVERROR(EAGAIN) on timeout, AVERROR_EXIT when closed
+	 **/
+	int Acquire(AVFrame* &frame, int timeout_ms = -1){
+		return free_frames.Recv(frame, timeout_ms);
+	}
+
+	/** unref frame data and return frame to pool **/
+	void Release(AVFrame *frame){
+		if (frame == NULL) return;
+		av_frame_unref(frame);
+		free_frames.Send(frame, 0);
+	}
+
+	/** Release() n frames, returning them under one lock **/
+	void Release(AVFrame **frames_in, int n){
+		for (int i=0;i<n;i++)
+			av_frame_unref(frames_in[i]);
+		free_frames.SendBatch(frames_in, n, 0);
+	}
+
+	/** wake and fail pending Acquire calls **/
+	void Close(){
+		free_frames.SetErrRecv(AVERROR_EXIT);
+	}
+
+	/** no. frames not handed out **/
+	int Available(){
+		return free_frames.Size();
+	}
+
+	int Size() const {
+		return (int)frames.size();
+	}
+};
+
+/** RAII handle on a pooled frame
+ *  frame goes back to its pool when the handle is destroyed or reset.
+ *  All handles must be released before the owning VideoCapture is closed.
+ **/
+class VideoFrame {
+protected:
+	AVFrame *frame = NULL;
+	FramePool *pool = NULL;
+
+public:
+	VideoFrame(){}
+	VideoFrame(AVFrame *frame, FramePool *pool):frame(frame),pool(pool){}
+	VideoFrame(VideoFrame &&other):frame(other.frame),pool(other.pool){
+		other.frame = NULL;
+		other.pool = NULL;
+	}
+	VideoFrame& operator=(VideoFrame &&other){
+		if (this != &other){
+			Release();
+			frame = other.frame;
+			pool = other.pool;
+			other.frame = NULL;
+			other.pool = NULL;
+		}
+		return *this;
+	}
+	VideoFrame(const VideoFrame&) = delete;
+	VideoFrame& operator=(const VideoFrame&) = delete;
+
+	~VideoFrame(){
+		Release();
+	}
+
+	/** return frame to pool now **/
+	void Release(){
+		if (pool != NULL) pool->Release(frame);
+		frame = NULL;
+		pool = NULL;
+	}
+
+	AVFrame* get() const { return frame; }
+	AVFrame* operator->() const { return frame; }
+	explicit operator bool() const { return frame != NULL; }
+};
+
+} //namespace ph
+
+#endif
@@ -0,0 +1,190 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#ifndef _FRAMEVIEW_H
+#define _FRAMEVIEW_H
+
+#include <cstdint>
+#include <new>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/buffer.h>
+#include <libavutil/pixdesc.h>
+};
+
+#define PHPLANE_Y 0x01
+#define PHPLANE_U 0x02
+#define PHPLANE_V 0x04
+#define PHPLANE_ALL 0x0f
+
+namespace ph {
+
+/** one image plane, not owned **/
+typedef struct plane_view {
+	const uint8_t *data = NULL;   // NULL for planes not in the view
+	int linesize = 0;             // bytes per row, may exceed width
+	int width = 0;                // in samples
+	int height = 0;
+} PlaneView;
+
+/** read-only view on some planes of a decoded frame
+ *  Holds a reference on the buffer behind each selected plane and nothing
+ *  else: the AVFrame it came from can be released at once, and planes not
+ *  selected go back to the decoder's buffer pool. Plane pointers stay valid
+ *  for as long as this view or a copy of it exists, also after the
+ *  VideoCapture is closed. Copies share the buffers and never copy pixels.
+ *  The data is shared and must not be written.
+ *
+ *  e.g. cv::Mat y(v.Plane(0).height, v.Plane(0).width, CV_8UC1,
+ *                 (void*)v.Plane(0).data, v.Plane(0).linesize);
+ **/
+class FrameView {
+protected:
+	AVBufferRef *bufs[AV_NUM_DATA_POINTERS] = { NULL };
+	PlaneView planes[AV_NUM_DATA_POINTERS];
+	int nb_planes = 0;
+	int64_t pts = AV_NOPTS_VALUE;
+	int width = 0;
+	int height = 0;
+	int format = -1;
+	bool key_frame = false;
+
+	void CopyFrom(const FrameView &other){
+		for (int i=0;i<other.nb_planes;i++){
+			if (other.bufs[i] != NULL && (bufs[i] = av_buffer_ref(other.bufs[i])) == NULL){
+				Release();
+				throw std::bad_alloc();
+			}
+			planes[i] = other.planes[i];
+		}
+		nb_planes = other.nb_planes;
+		pts = other.pts;
+		width = other.width;
+		height = other.height;
+		format = other.format;
+		key_frame = other.key_frame;
+	}
+
+	void MoveFrom(FrameView &other){
+		for (int i=0;i<other.nb_planes;i++){
+			bufs[i] = other.bufs[i];
+			planes[i] = other.planes[i];
+			other.bufs[i] = NULL;
+			other.planes[i] = PlaneView();
+		}
+		nb_planes = other.nb_planes;
+		pts = other.pts;
+		width = other.width;
+		height = other.height;
+		format = other.format;
+		key_frame = other.key_frame;
+		other.nb_planes = 0;
+	}
+
+public:
+	FrameView(){}
+
+	/** view on planes of a refcounted frame
+	 *  @param frame       frame with data in AVBufferRefs
+	 *  @param plane_mask  PHPLANE_* flags
+	 *  @throws std::bad_alloc
+	 **/
+	FrameView(const AVFrame *frame, unsigned plane_mask = PHPLANE_ALL){
+		const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+		pts = frame->pts;
+		width = frame->width;
+		height = frame->height;
+		format = frame->format;
+		key_frame = frame->key_frame;
+		while (nb_planes < AV_NUM_DATA_POINTERS && frame->data[nb_planes] != NULL)
+			nb_planes++;
+		for (int i=0;i<nb_planes;i++){
+			if (!(plane_mask & (1U << i))) continue;
+			AVBufferRef *buf = av_frame_get_plane_buffer((AVFrame*)frame, i);
+			if (buf == NULL || (bufs[i] = av_buffer_ref(buf)) == NULL){
+				Release();
+				throw std::bad_alloc();
+			}
+			bool chroma = desc != NULL && (i == 1 || i == 2);
+			planes[i].data = frame->data[i];
+			planes[i].linesize = frame->linesize[i];
+			planes[i].width = (chroma) ? AV_CEIL_RSHIFT(width, desc->log2_chroma_w) : width;
+			planes[i].height = (chroma) ? AV_CEIL_RSHIFT(height, desc->log2_chroma_h) : height;
+		}
+	}
+
+	FrameView(const FrameView &other){
+		CopyFrom(other);
+	}
+
+	FrameView(FrameView &&other){
+		MoveFrom(other);
+	}
+
+	FrameView& operator=(const FrameView &other){
+		if (this != &other){
+			Release();
+			CopyFrom(other);
+		}
+		return *this;
+	}
+
+	FrameView& operator=(FrameView &&other){
+		if (this != &other){
+			Release();
+			MoveFrom(other);
+		}
+		return *this;
+	}
+
+	~FrameView(){
+		Release();
+	}
+
+	/** drop the buffer references; view becomes empty **/
+	void Release(){
+		for (int i=0;i<AV_NUM_DATA_POINTERS;i++){
+			av_buffer_unref(&bufs[i]);
+			planes[i] = PlaneView();
+		}
+		nb_planes = 0;
+	}
+
+	/** plane i; data is NULL when it was not selected **/
+	const PlaneView& Plane(int i) const { return planes[i]; }
+	int NumberPlanes() const { return nb_planes; }
+	int64_t Pts() const { return pts; }
+	int Width() const { return width; }
+	int Height() const { return height; }
+	int Format() const { return format; }
+	bool KeyFrame() const { return key_frame; }
+	explicit operator bool() const { return nb_planes > 0; }
+};
+
+} //namespace ph
+
+#endif
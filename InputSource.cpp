@@ -0,0 +1,103 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "VideoCapture.hpp"
+
+extern "C" {
+#include <libavformat/avio.h>
+};
+
+using namespace ph;
+using namespace std;
+
+int MemorySource::Read(uint8_t *buf, int buf_size){
+	size_t remaining = size - pos;
+	size_t n = ((size_t)buf_size < remaining) ? (size_t)buf_size : remaining;
+	memcpy(buf, data + pos, n);
+	pos += n;
+	return (int)n;
+}
+
+int64_t MemorySource::Seek(int64_t offset, int whence){
+	int64_t newpos;
+	switch (whence & ~AVSEEK_FORCE){
+	case AVSEEK_SIZE:
+		return (int64_t)size;
+	case SEEK_SET:
+		newpos = offset;
+		break;
+	case SEEK_CUR:
+		newpos = (int64_t)pos + offset;
+		break;
+	case SEEK_END:
+		newpos = (int64_t)size + offset;
+		break;
+	default:
+		return -1;
+	}
+	if (newpos < 0 || newpos > (int64_t)size) return -1;
+	pos = (size_t)newpos;
+	return newpos;
+}
+
+MappedFileSource::MappedFileSource(const string &filename):MemorySource(NULL, 0){
+	char msg[64];
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0){
+		snprintf(msg, sizeof(msg), "unable to open file: %s", strerror(errno));
+		throw VideoCaptureException(string(msg));
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) < 0){
+		snprintf(msg, sizeof(msg), "unable to stat file: %s", strerror(errno));
+		close(fd);
+		throw VideoCaptureException(string(msg));
+	}
+	size = sb.st_size;
+	if (size > 0){
+		void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED){
+			snprintf(msg, sizeof(msg), "unable to map file: %s", strerror(errno));
+			close(fd);
+			throw VideoCaptureException(string(msg));
+		}
+		madvise(addr, size, MADV_SEQUENTIAL);
+		data = (const uint8_t*)addr;
+	}
+	close(fd);  // mapping stays valid
+}
+
+MappedFileSource::~MappedFileSource(){
+	if (data != NULL)
+		munmap((void*)data, size);
+}
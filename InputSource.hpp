@@ -0,0 +1,105 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#ifndef _INPUTSOURCE_H
+#define _INPUTSOURCE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <functional>
+
+namespace ph {
+
+/** media byte source read by libavformat through a custom AVIOContext
+ *  must outlive the VideoCapture reading it
+ **/
+class InputSource {
+public:
+	virtual ~InputSource(){}
+
+	/** copy up to size bytes into buf
+	 *  @return no. bytes read, 0 at end of input, neg. libav error code
+	 **/
+	virtual int Read(uint8_t *buf, int size) = 0;
+
+	/** seek as in fseek, or return total size for whence == AVSEEK_SIZE
+	 *  @return new position, or neg. value if unsupported
+	 **/
+	virtual int64_t Seek(int64_t offset, int whence) = 0;
+
+	virtual bool Seekable() const { return true; }
+};
+
+/** caller-owned memory buffer, not copied up front; Read() copies each
+ *  chunk into the demuxer's io buffer, as for any other source
+ **/
+class MemorySource : public InputSource {
+protected:
+	const uint8_t *data;
+	size_t size;
+	size_t pos = 0;
+
+public:
+	MemorySource(const uint8_t *data, size_t size):data(data),size(size){}
+	int Read(uint8_t *buf, int size) override;
+	int64_t Seek(int64_t offset, int whence) override;
+};
+
+/** memory mapped file with sequential readahead advice
+ *  @throws VideoCaptureException when the file cannot be mapped
+ **/
+class MappedFileSource : public MemorySource {
+public:
+	MappedFileSource(const std::string &filename);
+	~MappedFileSource();
+	MappedFileSource(const MappedFileSource&) = delete;
+	MappedFileSource& operator=(const MappedFileSource&) = delete;
+};
+
+/** user supplied read and (optional) seek functions **/
+class CallbackSource : public InputSource {
+public:
+	typedef std::function<int(uint8_t *buf, int size)> ReadFunc;
+	typedef std::function<int64_t(int64_t offset, int whence)> SeekFunc;
+
+protected:
+	ReadFunc read_func;
+	SeekFunc seek_func;
+
+public:
+	CallbackSource(ReadFunc read_func, SeekFunc seek_func = nullptr)
+		:read_func(read_func),seek_func(seek_func){}
+	int Read(uint8_t *buf, int size) override { return read_func(buf, size); }
+	int64_t Seek(int64_t offset, int whence) override {
+		return (seek_func) ? seek_func(offset, whence) : -1;
+	}
+	bool Seekable() const override { return (bool)seek_func; }
+};
+
+} //namespace ph
+
+#endif
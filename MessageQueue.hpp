@@ -0,0 +1,184 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#ifndef _MESSAGEQUEUE_H
+#define _MESSAGEQUEUE_H
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+extern "C" {
+#include <libavutil/error.h>
+};
+
+namespace ph {
+
+/** bounded message queue
+ *  same semantics as AVThreadMessageQueue, except that receivers
+ *  sleep on a condition variable with an optional timeout instead
+ *  of polling.  Error codes are libav error codes.
+ **/
+template<typename T>
+class MessageQueue {
+protected:
+	std::mutex mtx;
+	std::condition_variable cond_recv;
+	std::condition_variable cond_send;
+	std::vector<T> items;
+	size_t head = 0;
+	size_t count = 0;
+	int err_send = 0;
+	int err_recv = 0;
+
+	/* wait on cond until pred holds
+	 * timeout_ms < 0 waits indefinitely, 0 does not wait */
+	template<typename Pred>
+	bool Wait(std::unique_lock<std::mutex> &lck, std::condition_variable &cond,
+			  int timeout_ms, Pred pred){
+		if (timeout_ms < 0){
+			cond.wait(lck, pred);
+			return true;
+		}
+		if (timeout_ms == 0)
+			return pred();
+		return cond.wait_for(lck, std::chrono::milliseconds(timeout_ms), pred);
+	}
+
+public:
+	MessageQueue(unsigned capacity):items(capacity){}
+
+	/** send item
+	 *  @param item
+	 *  @param timeout_ms time to wait for a free slot (neg. to block, 0 for none)
+	 *  @return 0 on success, AVERROR(EAGAIN) when full, or error set by SetErrSend
+	 **/
+	int Send(const T &item, int timeout_ms = -1){
+		std::unique_lock<std::mutex> lck(mtx);
+		if (!Wait(lck, cond_send, timeout_ms,
+				  [this]{ return err_send != 0 || count < items.size(); }))
+			return AVERROR(EAGAIN);
+		if (err_send) return err_send;
+		items[(head + count) % items.size()] = item;
+		count++;
+		lck.unlock();
+		cond_recv.notify_one();
+		return 0;
+	}
+
+	/** send up to n items under one lock
+	 *  waits for room for at least one, then sends as many as fit
+	 *  @return no. items sent, AVERROR(EAGAIN) when full, or error set by SetErrSend
+	 **/
+	int SendBatch(const T *items_in, int n, int timeout_ms = -1){
+		std::unique_lock<std::mutex> lck(mtx);
+		if (!Wait(lck, cond_send, timeout_ms,
+				  [this]{ return err_send != 0 || count < items.size(); }))
+			return AVERROR(EAGAIN);
+		if (err_send) return err_send;
+		int nb = 0;
+		while (nb < n && count < items.size()){
+			items[(head + count) % items.size()] = items_in[nb++];
+			count++;
+		}
+		lck.unlock();
+		if (nb > 1) cond_recv.notify_all();
+		else cond_recv.notify_one();
+		return nb;
+	}
+
+	/** receive item
+	 *  @param item
+	 *  @param timeout_ms time to wait for an item (neg. to block, 0 for none)
+	 *  @return 0 on success, AVERROR(EAGAIN) when empty, or error set by SetErrRecv
+	 *          once the queue is drained
+	 **/
+	int Recv(T &item, int timeout_ms = -1){
+		std::unique_lock<std::mutex> lck(mtx);
+		if (!Wait(lck, cond_recv, timeout_ms,
+				  [this]{ return err_recv != 0 || count > 0; }))
+			return AVERROR(EAGAIN);
+		if (count == 0) return err_recv;
+		item = items[head];
+		head = (head + 1) % items.size();
+		count--;
+		lck.unlock();
+		cond_send.notify_one();
+		return 0;
+	}
+
+	/** receive up to max items under one lock
+	 *  waits for at least one, then takes whatever is ready
+	 *  @return no. items received, AVERROR(EAGAIN) when empty, or error set
+	 *          by SetErrRecv once the queue is drained
+	 **/
+	int RecvBatch(T *out, int max, int timeout_ms = -1){
+		std::unique_lock<std::mutex> lck(mtx);
+		if (!Wait(lck, cond_recv, timeout_ms,
+				  [this]{ return err_recv != 0 || count > 0; }))
+			return AVERROR(EAGAIN);
+		if (count == 0) return err_recv;
+		int nb = 0;
+		while (nb < max && count > 0){
+			out[nb++] = items[head];
+			head = (head + 1) % items.size();
+			count--;
+		}
+		lck.unlock();
+		if (nb > 1) cond_send.notify_all();
+		else cond_send.notify_one();
+		return nb;
+	}
+
+	/** error returned to senders; wakes blocked senders **/
+	void SetErrSend(int err){
+		std::lock_guard<std::mutex> lck(mtx);
+		err_send = err;
+		cond_send.notify_all();
+	}
+
+	/** error returned to receivers once queue is empty; wakes blocked receivers **/
+	void SetErrRecv(int err){
+		std::lock_guard<std::mutex> lck(mtx);
+		err_recv = err;
+		cond_recv.notify_all();
+	}
+
+	int Size(){
+		std::lock_guard<std::mutex> lck(mtx);
+		return (int)count;
+	}
+
+	int Capacity() const {
+		return (int)items.size();
+	}
+};
+
+} //namespace ph
+
+#endif
@@ -0,0 +1,249 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#include <cmath>
+#include <algorithm>
+#include "PHash.hpp"
+
+extern "C" {
+#include <libavutil/cpu.h>
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PHASH_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#define PHASH_NEON 1
+#include <arm_neon.h>
+#endif
+
+using namespace ph;
+using namespace std;
+
+static const int DctSize = 32;
+static const int HashSize = 8;
+
+/** scalar kernels **/
+
+static uint32_t sum_u8_c(const uint8_t *p, int n){
+	uint32_t sum = 0;
+	for (int i=0;i<n;i++)
+		sum += p[i];
+	return sum;
+}
+
+static float dot32_c(const float *a, const float *b){
+	float sum = 0;
+	for (int i=0;i<DctSize;i++)
+		sum += a[i]*b[i];
+	return sum;
+}
+
+static const HashKernels kernels_c = { "c", sum_u8_c, dot32_c };
+
+#ifdef PHASH_X86
+
+/** sse2 kernels: baseline on x86_64, also used on sse4 cpus (see PHash.hpp) **/
+
+__attribute__((target("sse2")))
+static uint32_t sum_u8_sse2(const uint8_t *p, int n){
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = _mm_setzero_si128();
+	int i = 0;
+	for (;i+16<=n;i+=16)
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(p+i)), zero));
+	uint32_t sum = (uint32_t)(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+	return sum + sum_u8_c(p+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static float dot32_sse2(const float *a, const float *b){
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+	for (int i=0;i<DctSize;i+=8){
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a+i+4), _mm_loadu_ps(b+i+4)));
+	}
+	__m128 acc = _mm_add_ps(acc0, acc1);
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	return _mm_cvtss_f32(acc);
+}
+
+static const HashKernels kernels_sse2 = { "sse2", sum_u8_sse2, dot32_sse2 };
+
+/** avx2 + fma kernels **/
+
+__attribute__((target("avx2")))
+static uint32_t sum_u8_avx2(const uint8_t *p, int n){
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc = _mm256_setzero_si256();
+	int i = 0;
+	for (;i+32<=n;i+=32)
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(p+i)), zero));
+	__m128i acc128 = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	uint32_t sum = (uint32_t)(_mm_cvtsi128_si32(acc128) + _mm_cvtsi128_si32(_mm_srli_si128(acc128, 8)));
+	return sum + sum_u8_sse2(p+i, n-i);
+}
+
+__attribute__((target("avx2,fma")))
+static float dot32_avx2(const float *a, const float *b){
+	__m256 acc0 = _mm256_mul_ps(_mm256_loadu_ps(a), _mm256_loadu_ps(b));
+	__m256 acc1 = _mm256_mul_ps(_mm256_loadu_ps(a+8), _mm256_loadu_ps(b+8));
+	acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a+16), _mm256_loadu_ps(b+16), acc0);
+	acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a+24), _mm256_loadu_ps(b+24), acc1);
+	__m256 acc = _mm256_add_ps(acc0, acc1);
+	__m128 acc128 = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+	acc128 = _mm_add_ps(acc128, _mm_movehl_ps(acc128, acc128));
+	acc128 = _mm_add_ss(acc128, _mm_shuffle_ps(acc128, acc128, 1));
+	return _mm_cvtss_f32(acc128);
+}
+
+static const HashKernels kernels_avx2 = { "avx2", sum_u8_avx2, dot32_avx2 };
+
+#endif // PHASH_X86
+
+#ifdef PHASH_NEON
+
+/** neon kernels: always present on aarch64 **/
+
+static uint32_t sum_u8_neon(const uint8_t *p, int n){
+	uint32x4_t acc = vdupq_n_u32(0);
+	int i = 0;
+	for (;i+16<=n;i+=16)
+		acc = vpadalq_u16(acc, vpaddlq_u8(vld1q_u8(p+i)));
+	uint32x2_t acc2 = vadd_u32(vget_low_u32(acc), vget_high_u32(acc));
+	uint32_t sum = vget_lane_u32(vpadd_u32(acc2, acc2), 0);
+	return sum + sum_u8_c(p+i, n-i);
+}
+
+static float dot32_neon(const float *a, const float *b){
+	float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+	for (int i=0;i<DctSize;i+=8){
+		acc0 = vmlaq_f32(acc0, vld1q_f32(a+i), vld1q_f32(b+i));
+		acc1 = vmlaq_f32(acc1, vld1q_f32(a+i+4), vld1q_f32(b+i+4));
+	}
+	float32x4_t acc = vaddq_f32(acc0, acc1);
+	float32x2_t acc2 = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+	return vget_lane_f32(vpadd_f32(acc2, acc2), 0);
+}
+
+static const HashKernels kernels_neon = { "neon", sum_u8_neon, dot32_neon };
+
+#endif // PHASH_NEON
+
+vector<const HashKernels*> ph::GetAvailableHashKernels(){
+	vector<const HashKernels*> available;
+	available.push_back(&kernels_c);
+	int flags = av_get_cpu_flags();
+	(void)flags;
+#ifdef PHASH_X86
+	if (flags & AV_CPU_FLAG_SSE2)
+		available.push_back(&kernels_sse2);
+	if ((flags & AV_CPU_FLAG_SSE2) && (flags & AV_CPU_FLAG_AVX2) && (flags & AV_CPU_FLAG_FMA3))
+		available.push_back(&kernels_avx2);
+#endif
+#ifdef PHASH_NEON
+	available.push_back(&kernels_neon);
+#endif
+	return available;
+}
+
+const HashKernels& ph::GetHashKernels(){
+	static const HashKernels *best = GetAvailableHashKernels().back();
+	return *best;
+}
+
+/** mean of each cell of a grid x grid partition of the plane **/
+static void grid_means(const uint8_t *plane, int linesize, int width, int height,
+					   int grid, float *means, const HashKernels &k){
+	for (int gy=0;gy<grid;gy++){
+		int y0 = gy*height/grid;
+		int y1 = max((gy+1)*height/grid, y0+1);
+		for (int gx=0;gx<grid;gx++){
+			int x0 = gx*width/grid;
+			int x1 = max((gx+1)*width/grid, x0+1);
+			uint32_t sum = 0;
+			for (int y=y0;y<y1;y++)
+				sum += k.sum_u8(plane + (size_t)y*linesize + x0, x1 - x0);
+			means[gy*grid + gx] = (float)sum/(float)((y1 - y0)*(x1 - x0));
+		}
+	}
+}
+
+/** bit i set where values[i] exceeds the median of all 64 **/
+static uint64_t threshold_median(const float *values){
+	float sorted[HashSize*HashSize];
+	copy(values, values + HashSize*HashSize, sorted);
+	nth_element(sorted, sorted + HashSize*HashSize/2, sorted + HashSize*HashSize);
+	float median = sorted[HashSize*HashSize/2];
+	uint64_t hash = 0;
+	for (int i=0;i<HashSize*HashSize;i++){
+		if (values[i] > median)
+			hash |= (1ULL << i);
+	}
+	return hash;
+}
+
+/** rows of the dct-ii basis for the HashSize lowest frequencies **/
+struct DctBasis {
+	float c[HashSize][DctSize];
+	DctBasis(){
+		for (int k=0;k<HashSize;k++){
+			float scale = (k == 0) ? sqrtf(1.0f/DctSize) : sqrtf(2.0f/DctSize);
+			for (int x=0;x<DctSize;x++)
+				c[k][x] = scale*cosf((float)M_PI*(2*x + 1)*k/(2*DctSize));
+		}
+	}
+};
+
+uint64_t ph::PHash(const uint8_t *plane, int linesize, int width, int height,
+				   const HashKernels &k){
+	static const DctBasis basis;
+
+	float img[DctSize*DctSize];
+	grid_means(plane, linesize, width, height, DctSize, img, k);
+
+	// only the low frequency corner is needed: D = C8 * img * C8^T
+	// rows of img against the basis give tmp^T, then basis against tmp^T
+	float tmp[HashSize][DctSize];
+	for (int y=0;y<DctSize;y++){
+		for (int v=0;v<HashSize;v++)
+			tmp[v][y] = k.dot32(img + y*DctSize, basis.c[v]);
+	}
+	float coeffs[HashSize*HashSize];
+	for (int u=0;u<HashSize;u++){
+		for (int v=0;v<HashSize;v++)
+			coeffs[u*HashSize + v] = k.dot32(basis.c[u], tmp[v]);
+	}
+	return threshold_median(coeffs);
+}
+
+uint64_t ph::BlockMeanHash(const uint8_t *plane, int linesize, int width, int height,
+						   const HashKernels &k){
+	float means[HashSize*HashSize];
+	grid_means(plane, linesize, width, height, HashSize, means, k);
+	return threshold_median(means);
+}
@@ -0,0 +1,71 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#ifndef _PHASH_H
+#define _PHASH_H
+
+#include <cstdint>
+#include <vector>
+
+namespace ph {
+
+/** hashes of one video frame **/
+typedef struct hash_record {
+	int64_t pts;
+	uint64_t phash;     // 32x32 dct hash
+	uint64_t bmhash;    // 8x8 block mean hash
+} HashRecord;
+
+/** simd kernels used by the hash functions
+ *  sets: c, sse2 and avx2+fma on x86, neon on arm. There is no sse4 set:
+ *  psadbw and mulps/addps are sse2, and sse4.1's dpps is slower than
+ *  mul+add for a 32 float dot product, so sse2 serves sse4 cpus.
+ **/
+typedef struct hash_kernels {
+	const char *name;
+	uint32_t (*sum_u8)(const uint8_t *p, int n);     // sum of n bytes
+	float (*dot32)(const float *a, const float *b);  // dot product of 32 floats
+} HashKernels;
+
+/** fastest kernels supported by this cpu, chosen on first call **/
+const HashKernels& GetHashKernels();
+
+/** every kernel set this cpu supports, scalar first **/
+std::vector<const HashKernels*> GetAvailableHashKernels();
+
+/** dct hash: luma plane averaged down to 32x32, 2d dct,
+ *  8x8 lowest frequencies compared to their median
+ **/
+uint64_t PHash(const uint8_t *plane, int linesize, int width, int height,
+			   const HashKernels &kernels = GetHashKernels());
+
+/** block mean hash: means of an 8x8 grid of blocks compared to their median **/
+uint64_t BlockMeanHash(const uint8_t *plane, int linesize, int width, int height,
+					   const HashKernels &kernels = GetHashKernels());
+
+} //namespace ph
+
+#endif
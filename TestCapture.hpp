@@ -0,0 +1,92 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+/* capture helpers shared by testcapture and testasync; test code only */
+
+#ifndef _TESTCAPTURE_H
+#define _TESTCAPTURE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <exception>
+#include "VideoCapture.hpp"
+
+using namespace std;
+
+static ph::CaptureOptions video_options(){
+	ph::CaptureOptions opts;
+	opts.flag = PHCAPTURE_VIDEO_FLAG;
+	return opts;
+}
+
+/* video pts of the frames queued while run() drives vc */
+static vector<int64_t> pulled_pts(ph::VideoCapture &vc, function<void()> run){
+	vector<int64_t> pts;
+	exception_ptr ex;
+	thread producer([&]{
+			try {
+				run();
+			} catch (...){
+				ex = current_exception();
+			}
+		});
+	AVFrame *frame;
+	while (vc.PullPooledVideoFrame(frame) == 0){
+		pts.push_back(frame->pts);
+		vc.ReleaseVideoFrame(frame);
+	}
+	producer.join();
+	if (ex) rethrow_exception(ex);
+	return pts;
+}
+
+/* video pts of a plain Process() run over path, the reference for the other modes */
+static vector<int64_t> serial_pts(const string &path, const ph::CaptureOptions &opts = video_options()){
+	ph::VideoCapture vc(path, opts);
+	return pulled_pts(vc, [&]{ vc.Process(); });
+}
+
+static bool same_pts(const char *name, const vector<int64_t> &expected, const vector<int64_t> &got){
+	size_t n = (expected.size() < got.size()) ? expected.size() : got.size();
+	for (size_t i=0;i<n;i++){
+		if (expected[i] != got[i]){
+			cout << name << ": FAIL frame " << i << " pts " << got[i]
+				 << ", expected " << expected[i] << endl;
+			return false;
+		}
+	}
+	if (expected.size() != got.size()){
+		cout << name << ": FAIL " << got.size() << " frames, expected " << expected.size() << endl;
+		return false;
+	}
+	cout << name << ": ok, " << got.size() << " frames" << endl;
+	return true;
+}
+
+#endif
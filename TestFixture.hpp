@@ -0,0 +1,228 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+/* lavfi generated fixtures for benchvc and the capture tests; test code only */
+
+#ifndef _TESTFIXTURE_H
+#define _TESTFIXTURE_H
+
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+#include "VideoCapture.hpp"
+
+extern "C" {
+#include <libavfilter/buffersink.h>
+#include <libavutil/avutil.h>
+};
+
+using namespace std;
+
+const int FixtureRate = 25;
+const double FixtureSecs = 2.0;
+const int FixtureSampleRate = 44100;
+
+typedef struct fixture_spec {
+	const char *codec;
+	enum AVCodecID codec_id;
+	int width;
+	int height;
+	bool interlaced;
+} FixtureSpec;
+
+typedef struct output_stream {
+	AVCodecContext *enc = NULL;
+	AVStream *st = NULL;
+	AVFilterGraph *graph = NULL;
+	AVFilterContext *sink = NULL;
+	int64_t next_pts = 0;
+	bool interlaced = false;
+	bool done = false;
+} OutputStream;
+
+static string fixture_name(const FixtureSpec &spec){
+	char name[64];
+	snprintf(name, sizeof(name), "%s_%d%c", spec.codec, spec.height, (spec.interlaced) ? 'i' : 'p');
+	return string(name);
+}
+
+/* lavfi source chain ending in a buffer sink */
+static AVFilterGraph* open_source(const char *descr, bool video, AVFilterContext **sink){
+	AVFilterGraph *graph = avfilter_graph_alloc();
+	AVFilterInOut *inputs = avfilter_inout_alloc();
+	AVFilterInOut *outputs = NULL;
+	int rc = -1;
+	if (graph != NULL && inputs != NULL)
+		rc = avfilter_graph_create_filter(sink, avfilter_get_by_name((video) ? "buffersink" : "abuffersink"),
+										  "out", NULL, NULL, graph);
+	if (rc >= 0){
+		inputs->name = av_strdup("out");
+		inputs->filter_ctx = *sink;
+		inputs->pad_idx = 0;
+		inputs->next = NULL;
+		rc = avfilter_graph_parse_ptr(graph, descr, &inputs, &outputs, NULL);
+	}
+	if (rc >= 0)
+		rc = avfilter_graph_config(graph, NULL);
+	avfilter_inout_free(&inputs);
+	avfilter_inout_free(&outputs);
+	if (rc < 0)
+		avfilter_graph_free(&graph);
+	return graph;
+}
+
+static bool open_video(AVFormatContext *oc, const FixtureSpec &spec, double secs, OutputStream &os){
+	const AVCodec *codec = avcodec_find_encoder(spec.codec_id);
+	if (codec == NULL) return false;
+
+	// interlaced: fields of successive frames at twice the rate, woven together
+	char descr[256];
+	bool mjpeg = spec.codec_id == AV_CODEC_ID_MJPEG;
+	snprintf(descr, sizeof(descr), "testsrc=size=%dx%d:rate=%d:duration=%g%s,format=%s",
+			 spec.width, spec.height, (spec.interlaced) ? 2*FixtureRate : FixtureRate, secs,
+			 (spec.interlaced) ? ",tinterlace=mode=interleave_top" : "",
+			 (mjpeg) ? "yuvj420p" : "yuv420p");
+	if ((os.graph = open_source(descr, true, &os.sink)) == NULL) return false;
+	if ((os.enc = avcodec_alloc_context3(codec)) == NULL) return false;
+
+	os.interlaced = spec.interlaced;
+	os.enc->width = spec.width;
+	os.enc->height = spec.height;
+	os.enc->pix_fmt = (enum AVPixelFormat)av_buffersink_get_format(os.sink);
+	os.enc->time_base = av_buffersink_get_time_base(os.sink);
+	os.enc->framerate = av_make_q(FixtureRate, 1);
+	os.enc->gop_size = FixtureRate;
+	os.enc->max_b_frames = (mjpeg) ? 0 : 2;
+	os.enc->bit_rate = (int64_t)spec.width*spec.height*FixtureRate/8;
+	os.enc->thread_count = 1;   // deterministic output
+	if (spec.interlaced){
+		os.enc->flags |= AV_CODEC_FLAG_INTERLACED_DCT | AV_CODEC_FLAG_INTERLACED_ME;
+		os.enc->field_order = AV_FIELD_TT;
+	}
+	if (spec.codec_id == AV_CODEC_ID_H264)
+		av_opt_set(os.enc->priv_data, "preset", "veryfast", 0);
+	if (oc->oformat->flags & AVFMT_GLOBALHEADER)
+		os.enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	if (avcodec_open2(os.enc, codec, NULL) < 0) return false;
+
+	if ((os.st = avformat_new_stream(oc, NULL)) == NULL) return false;
+	os.st->time_base = os.enc->time_base;
+	return avcodec_parameters_from_context(os.st->codecpar, os.enc) >= 0;
+}
+
+static bool open_audio(AVFormatContext *oc, double secs, OutputStream &os){
+	const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_PCM_S16LE);
+	if (codec == NULL) return false;
+
+	char descr[256];
+	snprintf(descr, sizeof(descr),
+			 "sine=frequency=440:beep_factor=4:sample_rate=%d:duration=%g,"
+			 "aformat=sample_fmts=s16:channel_layouts=stereo,asetnsamples=n=1024:p=0",
+			 FixtureSampleRate, secs);
+	if ((os.graph = open_source(descr, false, &os.sink)) == NULL) return false;
+	if ((os.enc = avcodec_alloc_context3(codec)) == NULL) return false;
+
+	os.enc->sample_fmt = AV_SAMPLE_FMT_S16;
+	os.enc->sample_rate = FixtureSampleRate;
+	os.enc->channel_layout = AV_CH_LAYOUT_STEREO;
+	os.enc->channels = 2;
+	os.enc->time_base = av_make_q(1, FixtureSampleRate);
+	if (avcodec_open2(os.enc, codec, NULL) < 0) return false;
+
+	if ((os.st = avformat_new_stream(oc, NULL)) == NULL) return false;
+	os.st->time_base = os.enc->time_base;
+	return avcodec_parameters_from_context(os.st->codecpar, os.enc) >= 0;
+}
+
+static void close_stream(OutputStream &os){
+	avcodec_free_context(&os.enc);
+	avfilter_graph_free(&os.graph);
+}
+
+/* encode frame, or flush with NULL, and write out the packets */
+static int encode_write(AVFormatContext *oc, OutputStream &os, AVFrame *frame, AVPacket *pkt){
+	int rc = avcodec_send_frame(os.enc, frame);
+	if (rc < 0) return rc;
+	while ((rc = avcodec_receive_packet(os.enc, pkt)) >= 0){
+		av_packet_rescale_ts(pkt, os.enc->time_base, os.st->time_base);
+		pkt->stream_index = os.st->index;
+		if ((rc = av_interleaved_write_frame(oc, pkt)) < 0)
+			return rc;
+	}
+	return (rc == AVERROR(EAGAIN) || rc == AVERROR_EOF) ? 0 : rc;
+}
+
+/* move one source frame through the encoder */
+static int encode_next(AVFormatContext *oc, OutputStream &os, AVFrame *frame, AVPacket *pkt){
+	int rc = av_buffersink_get_frame(os.sink, frame);
+	if (rc == AVERROR_EOF){
+		os.done = true;
+		return encode_write(oc, os, NULL, pkt);
+	}
+	if (rc < 0) return rc;
+	os.next_pts = frame->pts + ((frame->nb_samples > 0) ? frame->nb_samples : 1);
+	frame->pict_type = AV_PICTURE_TYPE_NONE;  // testsrc marks every frame intra
+	if (os.interlaced){
+		frame->interlaced_frame = 1;
+		frame->top_field_first = 1;
+	}
+	rc = encode_write(oc, os, frame, pkt);
+	av_frame_unref(frame);
+	return rc;
+}
+
+/* testsrc video and sine beeps in matroska; false when the encoder is missing */
+static bool make_fixture(const FixtureSpec &spec, const string &path, double secs = FixtureSecs){
+	AVFormatContext *oc = NULL;
+	if (avformat_alloc_output_context2(&oc, NULL, "matroska", path.c_str()) < 0)
+		return false;
+	OutputStream video, audio;
+	AVFrame *frame = av_frame_alloc();
+	AVPacket *pkt = av_packet_alloc();
+
+	bool ok = frame != NULL && pkt != NULL;
+	if (ok) ok = open_video(oc, spec, secs, video) && open_audio(oc, secs, audio);
+	if (ok) ok = avio_open(&oc->pb, path.c_str(), AVIO_FLAG_WRITE) >= 0;
+	if (ok) ok = avformat_write_header(oc, NULL) >= 0;
+	while (ok && !(video.done && audio.done)){
+		bool next_video = !video.done
+			&& (audio.done || av_compare_ts(video.next_pts, video.enc->time_base,
+											audio.next_pts, audio.enc->time_base) <= 0);
+		ok = encode_next(oc, (next_video) ? video : audio, frame, pkt) >= 0;
+	}
+	if (ok) ok = av_write_trailer(oc) >= 0;
+
+	close_stream(video);
+	close_stream(audio);
+	if (oc->pb != NULL) avio_closep(&oc->pb);
+	avformat_free_context(oc);
+	av_frame_free(&frame);
+	av_packet_free(&pkt);
+	if (!ok) unlink(path.c_str());
+	return ok;
+}
+
+#endif
@@ -80,8 +80,8 @@ void process_video(ph::VideoCapture *vc){
 	int count = 0;
 	int64_t last_pts = AV_NOPTS_VALUE;
 	AVRational time_base = vc->GetVideoTimebase();
-	AVFrame *frame = vc->PullVideoFrame();
-	if (frame == NULL) return;
+	ph::VideoFrame frame;
+	if (vc->PullVideoFrame(frame) < 0) return;
 
 	cvNamedWindow("main", CV_WINDOW_AUTOSIZE);
 
@@ -91,16 +91,14 @@ void process_video(ph::VideoCapture *vc){
 	IplImage *img = cvCreateImageHeader(sz, IPL_DEPTH_8U, 1);
 	assert(img);
 	int64_t start_ts = frame->pts, ts;
-	while (frame != NULL){
+	do {
 		ts = frame->pts;
-		cvSetData(img, frame->data[0], frame->linesize[0]);
+		cvSetData(img, (void*)frame->data[0], frame->linesize[0]);
 		pause(frame->pts, last_pts, time_base);
 		cvShowImage("main", img);
 		cvWaitKey(10);
 		count++;
-		av_frame_free(&frame);
-		frame = vc->PullVideoFrame();
-	}
+	} while (vc->PullVideoFrame(frame) == 0);
 	int hrs, mins, secs;
 	process_timestamp(ts - start_ts, time_base, hrs, mins, secs);
 	cout << "video frames processed " << count << " in " << hrs << ":" << mins << ":" << secs << endl;
@@ -204,9 +202,12 @@ int main(int argc, char **argv){
 		ph::MetaData mdata = vc->GetMetaData();
 		print_metadata(mdata);
 
-		uint32_t nbframes = vc->CountVideoPackets();
+		int count_method;
+		bool count_exact;
+		uint32_t nbframes = vc->CountVideoPackets(count_method, count_exact);
 		double fr = vc->GetAvgFrameRate_d();
-		cout << "no. video frames: " << nbframes << endl;
+		cout << "no. video frames: " << nbframes << (count_exact ? "" : " (estimate)")
+			 << " method " << count_method << endl;
 		cout << "avg frame rate: " << fr << endl;
 		
 		main_thr = thread(process_main, vc, secs);
@@ -28,6 +28,11 @@ SOFTWARE.
 #include <algorithm>
 #include <climits>
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <chrono>
 #include "VideoCapture.hpp"
 
 extern "C" {
@@ -35,12 +40,50 @@ extern "C" {
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
 #include <libavutil/rational.h>	
-#include "circ_buf.h"
+#include <libavutil/cpu.h>
 };
 
 using namespace ph;
 using namespace std;
 
+static inline uint64_t now_ns(){
+	return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+		chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** add time since start to a stats counter **/
+static inline void add_elapsed(atomic<uint64_t> &counter, uint64_t start){
+	counter.fetch_add(now_ns() - start, memory_order_relaxed);
+}
+
+atomic_int VideoCapture::core_budget(0);
+atomic_int VideoCapture::nb_captures(0);
+atomic_int VideoCapture::threads_reserved(0);
+
+/* container index access across libavformat versions */
+static int index_entries_count(AVStream *st){
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+	return avformat_index_get_entries_count(st);
+#else
+	return st->nb_index_entries;
+#endif
+}
+
+static const AVIndexEntry* index_entry(AVStream *st, int idx){
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(58, 78, 100)
+	return avformat_index_get_entry(st, idx);
+#else
+	return (idx >= 0 && idx < st->nb_index_entries) ? &st->index_entries[idx] : NULL;
+#endif
+}
+
+/* pts of the last indexed key frame at or before ts, AV_NOPTS_VALUE if not indexed */
+static int64_t keyframe_before(AVStream *st, int64_t ts){
+	const AVIndexEntry *entry = index_entry(st, av_index_search_timestamp(st, ts, AVSEEK_FLAG_BACKWARD));
+	return (entry != NULL) ? entry->timestamp : AV_NOPTS_VALUE;
+}
+
+
 void VideoCapture::RegisterInit(bool warn){
 	if (warn)
 		av_log_set_level(AV_LOG_WARNING);
@@ -68,6 +111,42 @@ void VideoCapture::OpenFile(const string &file){
 	}
 }
 
+static int read_source(void *opaque, uint8_t *buf, int buf_size){
+	int n = ((InputSource*)opaque)->Read(buf, buf_size);
+	return (n == 0) ? AVERROR_EOF : n;
+}
+
+static int64_t seek_source(void *opaque, int64_t offset, int whence){
+	return ((InputSource*)opaque)->Seek(offset, whence);
+}
+
+void VideoCapture::OpenSource(InputSource *source){
+	char msg[32];
+	int rc;
+	const int avio_buffer_size = 0x0001 << 16;
+	uint8_t *avio_buffer = (uint8_t*)av_malloc(avio_buffer_size);
+	if (avio_buffer == NULL)
+		throw VideoCaptureException("unable to alloc io buffer");
+	avio_ctx = avio_alloc_context(avio_buffer, avio_buffer_size, 0, source, read_source, NULL,
+								  (source->Seekable()) ? seek_source : NULL);
+	if (avio_ctx == NULL){
+		av_free(avio_buffer);
+		throw VideoCaptureException("unable to alloc io context");
+	}
+	if ((fmt_ctx = avformat_alloc_context()) == NULL)
+		throw VideoCaptureException("unable to alloc format context");
+	fmt_ctx->pb = avio_ctx;
+	fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+	if ((rc = avformat_open_input(&fmt_ctx, NULL, 0, 0)) < 0){
+		av_strerror(rc, msg, sizeof(msg));
+		throw VideoCaptureException(string(msg));
+	}
+	if ((rc = avformat_find_stream_info(fmt_ctx, 0)) < 0){
+		av_strerror(rc, msg, sizeof(msg));
+		throw VideoCaptureException(string(msg));
+	}
+}
+
 void VideoCapture::InitMetaData(){
 	if (fmt_ctx == NULL) return;
 	if (fmt_ctx->metadata == NULL) return;
@@ -132,6 +211,11 @@ void VideoCapture::InitVideoCodec(){
 
 	dec_ctx = pCodecContext;
 	av_opt_set_int(dec_ctx, "refcounted_frames", 1, 0);
+	SetDecoderThreads(dec_ctx, options.video_threads, options.video_thread_type);
+	if (capture_flag & PHCAPTURE_KEYFRAME_FLAG){
+		dec_ctx->skip_frame = AVDISCARD_NONKEY;
+		fmt_ctx->streams[video_stream]->discard = AVDISCARD_NONKEY;
+	}
 
 	if ((rc = avcodec_open2(dec_ctx, pCodec, 0)) < 0){
 		av_strerror(rc, msg, sizeof(msg));
@@ -173,6 +257,7 @@ void VideoCapture::InitAudioCodec(){
 
 	adec_ctx = paCodecContext;
 	av_opt_set_int(adec_ctx, "refcounted_frames", 1, 0);
+	SetDecoderThreads(adec_ctx, options.audio_threads, options.audio_thread_type);
 	
 	if ((rc = avcodec_open2(adec_ctx, pCodec, 0)) < 0){
 		av_strerror(rc, msg, sizeof(msg));
@@ -222,20 +307,77 @@ void VideoCapture::InitSubtitleCodec(){
 	}
 }
 
+static void append_filter(string &descr, const char *filter){
+	if (!descr.empty()) descr += ",";
+	descr += filter;
+}
+
 void VideoCapture::InitVideoFilters(int tm, int bm, int lm, int rm, int width, int dst_fps){
 	if (dec_ctx == NULL) return;
 	char msg[32];
 	int rc;
-	const AVFilter *bufferSrc = avfilter_get_by_name("buffer");
-	const AVFilter *bufferSink = avfilter_get_by_name("buffersink");
-	AVFilterInOut *outputs = avfilter_inout_alloc();
-	AVFilterInOut *inputs  = avfilter_inout_alloc();
-	AVRational time_base = fmt_ctx->streams[video_stream]->time_base;
+
+	// cheapest chain for the requested output: crop and scale in the source
+	// format, deinterlace only interlaced streams, convert format last.
+	// yadif comes before crop, an odd top margin would swap the fields
+	string descr;
+	char part[64];
+	int crop_width = dec_ctx->width - lm - rm;
+	int crop_height = dec_ctx->height - tm - bm;
+	if (dst_fps > 0 && use_fps_filter && !(capture_flag & PHCAPTURE_KEYFRAME_FLAG)){
+		// not with key frames or seeks: it would pad the gaps with duplicates
+		snprintf(part, sizeof(part), "fps=fps=%d:round=near", dst_fps);
+		append_filter(descr, part);
+	}
+	bool interlaced = dec_ctx->field_order != AV_FIELD_UNKNOWN
+		&& dec_ctx->field_order != AV_FIELD_PROGRESSIVE;
+	if (options.deinterlace == PHDEINT_ON || (options.deinterlace == PHDEINT_AUTO && interlaced))
+		append_filter(descr, "yadif=0:-1:1");
+	if (tm > 0 || bm > 0 || lm > 0 || rm > 0){
+		// exact, else margins are rounded to the chroma subsampling
+		snprintf(part, sizeof(part), "crop=%d:%d:%d:%d:exact=1", crop_width, crop_height, lm, tm);
+		append_filter(descr, part);
+	}
+	if (width > 0 && width != crop_width){
+		snprintf(part, sizeof(part), "scale=w=%d:h=-1", width);  // keeps aspect ratio
+		append_filter(descr, part);
+	}
+
+	bool transform = !descr.empty();
+
+	// output format; frames are never handed out in hash-only mode
+	int pix_fmt = (capture_flag & PHCAPTURE_HASHONLY_FLAG) ? PHPIXFMT_GRAY8 : options.pix_fmt;
 	enum AVPixelFormat pix_fmts[] = { AV_PIX_FMT_YUV420P,
 									AV_PIX_FMT_YUV422P,
 									AV_PIX_FMT_YUV444P,
 									AV_PIX_FMT_GRAY8,
 									AV_PIX_FMT_NONE };
+	bool format_ok = false;
+	if (pix_fmt == PHPIXFMT_GRAY8){
+		append_filter(descr, "format=gray");
+		format_ok = dec_ctx->pix_fmt == AV_PIX_FMT_GRAY8;
+	} else if (pix_fmt == PHPIXFMT_SOURCE){
+		for (int i=0;pix_fmts[i] != AV_PIX_FMT_NONE;i++)
+			if (dec_ctx->pix_fmt == pix_fmts[i]) format_ok = true;
+	} else {
+		append_filter(descr, "format=yuv444p");
+		format_ok = dec_ctx->pix_fmt == AV_PIX_FMT_YUV444P;
+	}
+
+	// no transform, so frames go from the decoder straight to the queue
+	bypass_video_filters = !transform && format_ok;
+	if (bypass_video_filters){
+		av_log(NULL, AV_LOG_INFO, "video filter: none");
+		return;
+	}
+	if (descr.empty())
+		descr = "null";
+
+	const AVFilter *bufferSrc = avfilter_get_by_name("buffer");
+	const AVFilter *bufferSink = avfilter_get_by_name("buffersink");
+	AVFilterInOut *outputs = avfilter_inout_alloc();
+	AVFilterInOut *inputs  = avfilter_inout_alloc();
+	AVRational time_base = fmt_ctx->streams[video_stream]->time_base;
   
 	filter_graph = avfilter_graph_alloc();
 	if (outputs == NULL || inputs == NULL || filter_graph == NULL)
@@ -292,24 +434,12 @@ void VideoCapture::InitVideoFilters(int tm, int bm, int lm, int rm, int width, i
 	inputs->pad_idx     = 0;
 	inputs->next        = NULL;
 
-	int widthsc = width;
-	int heightsc = -1;  //keeps original aspect ratio intact
-	int crop_width = dec_ctx->width - lm - rm;
-	int crop_height = dec_ctx->height - tm - bm;
-
-	int src_fps = (int)(av_q2d(fmt_ctx->streams[video_stream]->avg_frame_rate) + 0.5);
-	int fps = (dst_fps > 0) ? dst_fps : src_fps;
-	// filter description
-	char filter_descr[128];
-	snprintf(filter_descr, sizeof(filter_descr),
-			 "fps=fps=%d:round=near,format=yuv444p,yadif=0:-1:1,crop=%d:%d:%d:%d,scale=w=%d:h=%d",
-  			 fps, crop_width, crop_height, lm, tm, widthsc, heightsc);
-	if ((rc = avfilter_graph_parse_ptr(filter_graph, filter_descr, &inputs, &outputs, NULL)) < 0){
+	if ((rc = avfilter_graph_parse_ptr(filter_graph, descr.c_str(), &inputs, &outputs, NULL)) < 0){
 		av_strerror(rc, msg, sizeof(msg));
 		throw VideoCaptureException(string(msg));
 	}
 
-	av_log(NULL, AV_LOG_INFO, "video filter: %s", filter_descr);
+	av_log(NULL, AV_LOG_INFO, "video filter: %s", descr.c_str());
 	if ((rc = av_opt_set_int(filter_graph, "thread_type", AVFILTER_THREAD_SLICE, AV_OPT_SEARCH_CHILDREN)) < 0){
 		av_strerror(rc, msg, sizeof(msg));
 		throw VideoCaptureException(string(msg));
@@ -400,70 +530,117 @@ void VideoCapture::InitAudioFilters(const int sr, const int flt_fmt){
     avfilter_inout_free(&outputs);
 }
 
+void VideoCapture::SetDecoderThreads(AVCodecContext *ctx, int threads, int thread_type){
+	if (threads == PHTHREADS_AUTO && ctx->codec_type == AVMEDIA_TYPE_AUDIO)
+		threads = 1;
+	if (threads != PHTHREADS_DEFAULT && budgeted){
+		threads = ReserveThreads(threads);
+		decoder_threads += threads;
+		ctx->thread_count = threads;
+	} else if (threads != PHTHREADS_DEFAULT){
+		ctx->thread_count = (threads > 0) ? threads : 1;
+	}
+
+	int type = 0;
+	if (thread_type & PHTHREAD_FRAME) type |= FF_THREAD_FRAME;
+	if (thread_type & PHTHREAD_SLICE) type |= FF_THREAD_SLICE;
+	if (type) ctx->thread_type = type;
+}
+
 void VideoCapture::InitMsgQueues(){
-	char msg[32];
-	int rc;
-	if (dec_ctx != NULL){ 
-		if ((rc = av_thread_message_queue_alloc(&video_frames_queue,
-													  QueueCapacity, sizeof(AVFrame*))) < 0){
-			av_strerror(rc, msg, sizeof(msg));
-			throw AudioCaptureException(string(msg));
-		}
-		av_thread_message_queue_set_err_recv(video_frames_queue, AVERROR(EAGAIN));
+	if (dec_ctx != NULL){
+		video_frames_queue = new MessageQueue<AVFrame*>(QueueCapacity);
+		video_frame_pool = new FramePool(QueueCapacity);
+		if (capture_flag & (PHCAPTURE_HASH_FLAG|PHCAPTURE_HASHONLY_FLAG))
+			hash_queue = new MessageQueue<HashRecord>(HashQueueCapacity);
+		if (capture_flag & PHCAPTURE_HASHONLY_FLAG)
+			video_frames_queue->SetErrRecv(AVERROR_EOF);
 	}
 	
 	if (adec_ctx != NULL){
-		circ_buf.head = 0;
-		circ_buf.tail = 0;
 		if (flt_fmt == 0){
-			circ_buf.s16samples = new int16_t[CircBufferSize];
+			s16_buf = new CircBuffer<int16_t>(CircBufferSize);
 		} else {
-			circ_buf.fltsamples = new float[CircBufferSize];
+			flt_buf = new CircBuffer<float>(CircBufferSize);
 		}
-	}
-	
-	if (subdec_ctx != NULL){
-		if ((rc = av_thread_message_queue_alloc(&subtitle_queue,
-												QueueCapacity, sizeof(AVSubtitle*)))){
-			av_strerror(rc, msg, sizeof(msg));
-			throw VideoCaptureException(string(msg));
+		if (capture_flag & (PHCAPTURE_AUDIOFP_FLAG|PHCAPTURE_AUDIOFPONLY_FLAG)){
+			fingerprinter = new AudioFingerprinter(sr);
+			fingerprint_queue = new MessageQueue<AudioFingerprint>(FingerprintQueueCapacity);
+			fingerprint_started = false;
+		}
+		if (capture_flag & PHCAPTURE_AUDIOFPONLY_FLAG){
+			if (s16_buf != NULL) s16_buf->Close();
+			if (flt_buf != NULL) flt_buf->Close();
 		}
-		av_thread_message_queue_set_err_recv(subtitle_queue, AVERROR(EAGAIN));
 	}
+	
+	if (subdec_ctx != NULL)
+		subtitle_queue = new MessageQueue<AVSubtitle*>(QueueCapacity);
 }
 
-void VideoCapture::FlushFrames(){
-
-        int ret = 0;
-
-	if (buffersrc_ctx != NULL) // EOF marker to filter graph
-		ret = av_buffersrc_add_frame_flags(buffersrc_ctx, NULL, 0);
-
-        if (ret <0)
-            std::cerr <<  "Pb with av_buffersrc_add_frame_flags(buffersrc_ctx, NULL, 0)" << "\n";
-
-	if (abuffersrc_ctx != NULL)
-		ret = av_buffersrc_add_frame_flags(abuffersrc_ctx, NULL, 0);
+void VideoCapture::FlushVideo(){
+	if (dec_ctx == NULL) return;
+	char msg[64];
+	int rc;
+	AVPacket pkt;               // drain frames held by decoder
+	av_init_packet(&pkt);
+	pkt.data = NULL;
+	pkt.size = 0;
+	HandleVideoPacket(pkt);
+	if (bypass_video_filters) return;
+	if ((rc = av_buffersrc_add_frame_flags(buffersrc_ctx, NULL, 0)) < 0){ // EOF marker to filter graph
+		av_strerror(rc, msg, sizeof(msg));
+		throw VideoCaptureException(string(msg));
+	}
+	PushVideoFrames();
+}
 
-        if (ret <0)
-            std::cerr <<  "Pb with av_buffersrc_add_frame_flags(abuffersrc_ctx, NULL, 0)" << "\n";
+void VideoCapture::FlushAudio(){
+	if (adec_ctx == NULL) return;
+	char msg[64];
+	int rc;
+	AVPacket pkt;
+	av_init_packet(&pkt);
+	pkt.data = NULL;
+	pkt.size = 0;
+	HandleAudioPacket(pkt);
+	if ((rc = av_buffersrc_add_frame_flags(abuffersrc_ctx, NULL, 0)) < 0){
+		av_strerror(rc, msg, sizeof(msg));
+		throw AudioCaptureException(string(msg));
+	}
+	PushAudioFrames();
+}
 
-	if (dec_ctx != NULL)   //flush frames from filters
-		PushVideoFrames();
-	if (adec_ctx != NULL)
-		PushAudioFrames();
+void VideoCapture::FlushFrames(){
+	FlushVideo();
+	FlushAudio();
+	SignalEndOfStream();
+}
 
+void VideoCapture::SignalEndOfStream(){
 	if (video_frames_queue != NULL)
-		av_thread_message_queue_set_err_recv(video_frames_queue, AVERROR_EOF);
+		video_frames_queue->SetErrRecv(AVERROR_EOF);
+	video_ended.store(true);
+	WakeVideoReady();
 	if (subtitle_queue != NULL)
-		av_thread_message_queue_set_err_recv(subtitle_queue , AVERROR_EOF);
+		subtitle_queue->SetErrRecv(AVERROR_EOF);
+	if (hash_queue != NULL)
+		hash_queue->SetErrRecv(AVERROR_EOF);
+	if (fingerprint_queue != NULL)
+		fingerprint_queue->SetErrRecv(AVERROR_EOF);
+	if (s16_buf != NULL)
+		s16_buf->Close();
+	if (flt_buf != NULL)
+		flt_buf->Close();
 }
 
 void VideoCapture::PushVideoFrames(){
 	char msg[64];
 	char msg2[32];
 	while (true){
+		uint64_t start = now_ns();
 		int rc = av_buffersink_get_frame(buffersink_ctx, pframe_filtered);
+		add_elapsed(counters.video_filter_ns, start);
 		if (rc == AVERROR(EAGAIN)) break;
 		if (rc == AVERROR_EOF) break;
 		if (rc < 0){
@@ -471,88 +648,194 @@ void VideoCapture::PushVideoFrames(){
 			snprintf(msg, sizeof(msg), "unable to get frame from filter: %s", msg2);
 			throw VideoCaptureException(string(msg));
 		}
-		AVFrame *frame = av_frame_clone(pframe_filtered);
-		if ((rc = av_thread_message_queue_send(video_frames_queue, (void*)&frame, 0)) < 0){
-			if (rc == AVERROR(EAGAIN)){
-				av_log(NULL, AV_LOG_ERROR, "video queue overrun");
-				av_frame_free(&frame);
-				break;
-			}
-			if (rc < 0){
-				av_strerror(rc, msg2, sizeof(msg2));
-				snprintf(msg, sizeof(msg), "unable to push video frame onto queue: %s", msg2);
-				throw VideoCaptureException(string(msg));
-			}
+		if (!QueueVideoFrame()) break;
+	}
+}
+
+/** hand pframe_filtered to the hash and frame queues
+ *  The pool holds as many frames as the queue, so a full queue shows up
+ *  as an empty pool; video_queue_policy decides what happens then.
+ *  @param rec  hashes already computed for the frame, or NULL
+ *  @return false when no more frames can be queued now
+ **/
+bool VideoCapture::QueueVideoFrame(const HashRecord *rec){
+	char msg[64];
+	char msg2[32];
+	int rc;
+	if (hash_queue != NULL){
+		HashRecord hashes;
+		if (rec == NULL){
+			hashes.pts = pframe_filtered->pts;
+			hashes.phash = PHash(pframe_filtered->data[0], pframe_filtered->linesize[0],
+								 pframe_filtered->width, pframe_filtered->height);
+			hashes.bmhash = BlockMeanHash(pframe_filtered->data[0], pframe_filtered->linesize[0],
+										  pframe_filtered->width, pframe_filtered->height);
+			rec = &hashes;
+		}
+		if ((rc = hash_queue->Send(*rec)) < 0){
+			av_frame_unref(pframe_filtered);
+			if (stop_requested.load())
+				return false;
+			av_strerror(rc, msg2, sizeof(msg2));
+			snprintf(msg, sizeof(msg), "unable to push frame hash onto queue: %s", msg2);
+			throw VideoCaptureException(string(msg));
+		}
+		if (capture_flag & PHCAPTURE_HASHONLY_FLAG){
+			av_frame_unref(pframe_filtered);
+			return true;
+		}
+	}
+	if (on_video_frame){
+		try {
+			on_video_frame(pframe_filtered);
+		} catch (...){
+			av_frame_unref(pframe_filtered);
+			throw;
+		}
+		av_frame_unref(pframe_filtered);
+		counters.video_frames.fetch_add(1, memory_order_relaxed);
+		return true;
+	}
+	AVFrame *frame = NULL;
+	int policy = options.video_queue_policy;
+	bool wait = policy == PHQUEUE_BLOCK
+		|| (policy == PHQUEUE_DROP_NONKEY && pframe_filtered->key_frame);
+	rc = video_frame_pool->Acquire(frame, (wait) ? -1 : 0);
+	if (rc == AVERROR(EAGAIN) && policy == PHQUEUE_DROP_OLDEST){
+		// reuse the oldest queued frame; if consumers hold them all, drop this one
+		if (video_frames_queue->Recv(frame, 0) == 0){
+			av_frame_unref(frame);
+			rc = 0;
 		}
+		counters.video_frames_dropped.fetch_add(1, memory_order_relaxed);
+	} else if (rc == AVERROR(EAGAIN)){
+		counters.video_frames_dropped.fetch_add(1, memory_order_relaxed);
+	}
+	if (rc == AVERROR(EAGAIN)){
+		av_log(NULL, AV_LOG_WARNING, "video queue overrun, frame dropped\n");
+		av_frame_unref(pframe_filtered);
+		return true;
+	}
+	if (rc < 0){
+		// pool closed by Stop() or Close(); nothing more is queued
 		av_frame_unref(pframe_filtered);
+		stop_requested.store(true);
+		return false;
 	}
+	av_frame_move_ref(frame, pframe_filtered);
+	// never full while we hold a pool frame
+	if ((rc = video_frames_queue->Send(frame)) < 0){
+		video_frame_pool->Release(frame);
+		av_strerror(rc, msg2, sizeof(msg2));
+		snprintf(msg, sizeof(msg), "unable to push video frame onto queue: %s", msg2);
+		throw VideoCaptureException(string(msg));
+	}
+	counters.video_frames.fetch_add(1, memory_order_relaxed);
+	WakeVideoReady();
+	return true;
 }
 
-void VideoCapture::HandleVideoPacket(AVPacket &pkt)
-{
-    char msg[64];
-    int rc, done = 0;
-
-    if (&pkt) {
-
-        rc = avcodec_send_packet(dec_ctx, &pkt);
-
-        if (rc < 0) {
-            if (rc == AVERROR_EOF)
-                rc = 0;
-            else {
-                av_strerror(rc, msg, sizeof(msg));
-                throw VideoCaptureException(string(msg));
-            }
-        }
-    }
-
-    rc = avcodec_receive_frame(dec_ctx, pframe_decoded);
+/* the waiter sets has_video_ready before looking at the queue, and the
+ * producer checks it after queueing, so one of them sees the other */
+void VideoCapture::WakeVideoReady(){
+	if (!has_video_ready.load())
+		return;
+	function<void()> fn;
+	{
+		lock_guard<mutex> lck(ready_mtx);
+		fn.swap(video_ready);
+		has_video_ready.store(false);
+	}
+	if (fn) fn();
+}
 
-    if (rc < 0 && rc != AVERROR(EAGAIN) && rc != AVERROR_EOF)
-    {
-        av_strerror(rc, msg, sizeof(msg));
-        throw VideoCaptureException(string(msg));
-    }
+void VideoCapture::OnVideoFrame(VideoFrameCallback cb){
+	on_video_frame = move(cb);
+}
 
-    if (rc >= 0)
-        done = 1;
+void VideoCapture::OnAudioSamples(AudioSamplesCallback cb){
+	on_audio_samples = move(cb);
+	if (on_audio_samples){
+		// never written now; 1M samples not worth keeping
+		delete s16_buf;
+		delete flt_buf;
+		s16_buf = NULL;
+		flt_buf = NULL;
+	}
+}
 
-    rc = pkt.size;
+void VideoCapture::OnSubtitle(SubtitleCallback cb){
+	on_subtitle = move(cb);
+}
 
-    pkt.size -= rc;
-    pkt.data += rc;
+bool VideoCapture::NotifyVideoReady(function<void()> fn){
+	unique_lock<mutex> lck(ready_mtx);
+	video_ready = move(fn);
+	has_video_ready.store(true);
+	if (video_frames_queue == NULL || video_ended.load() || video_frames_queue->Size() > 0){
+		video_ready = nullptr;
+		has_video_ready.store(false);
+		return false;
+	}
+	return true;
+}
 
-    if (done)
-    {
+void VideoCapture::HandleVideoPacket(AVPacket &pkt){
+	char msg[64];
+	int rc;
+	// null data flushes the decoder
+	uint64_t start = now_ns();
+	rc = avcodec_send_packet(dec_ctx, (pkt.data != NULL) ? &pkt : NULL);
+	add_elapsed(counters.video_decode_ns, start);
+	if (rc < 0 && rc != AVERROR_EOF){
+		av_strerror(rc, msg, sizeof(msg));
+		throw VideoCaptureException(string(msg));
+	}
+	while (true){
+		start = now_ns();
+		rc = avcodec_receive_frame(dec_ctx, pframe_decoded);
+		add_elapsed(counters.video_decode_ns, start);
+		if (rc == AVERROR(EAGAIN) || rc == AVERROR_EOF) break;
+		if (rc < 0){
+			av_strerror(rc, msg, sizeof(msg));
+			throw VideoCaptureException(string(msg));
+		}
 #ifndef FF_API_FRAME_GET_SET
-        pframe_decoded->pts = av_frame_get_best_effort_timestamp(pframe_decoded);
+		pframe_decoded->pts = av_frame_get_best_effort_timestamp(pframe_decoded);
 #else
-        pframe_decoded->pts = pframe_decoded->best_effort_timestamp;
+		pframe_decoded->pts = pframe_decoded->best_effort_timestamp;
 #endif
-
-
-        if ((rc = av_buffersrc_add_frame_flags(buffersrc_ctx, pframe_decoded,
-                                               AV_BUFFERSRC_FLAG_KEEP_REF)) < 0)
-        {
-            av_strerror(rc, msg, sizeof(msg));
-            printf("error adding frame to buffer: %s %x\n", msg, rc);
-            throw VideoCaptureException(string(msg));
-        }
-
-        av_frame_unref(pframe_decoded);
-        PushVideoFrames();
-    }
+		if (!InRange(0, pframe_decoded->pts, 1)){
+			av_frame_unref(pframe_decoded);
+			continue;
+		}
+		if (bypass_video_filters){
+			av_frame_move_ref(pframe_filtered, pframe_decoded);
+			QueueVideoFrame();
+			continue;
+		}
+		start = now_ns();
+		rc = av_buffersrc_add_frame_flags(buffersrc_ctx, pframe_decoded, AV_BUFFERSRC_FLAG_KEEP_REF);
+		add_elapsed(counters.video_filter_ns, start);
+		if (rc < 0){
+			av_strerror(rc, msg, sizeof(msg));
+			throw VideoCaptureException(string(msg));
+		}
+		av_frame_unref(pframe_decoded);
+		PushVideoFrames();
+	}
 }
 
 void VideoCapture::PushAudioFrames_flt(){
 	char msg[64];
 	char msg2[32];
 	while (true){
+		uint64_t start = now_ns();
 		int rc = av_buffersink_get_frame(abuffersink_ctx, pframeAufiltered);
+		add_elapsed(counters.audio_filter_ns, start);
 		if (rc == AVERROR(EAGAIN)) break;
 		if (rc == AVERROR_EOF){
-			stop_flag.store(true, memory_order_release);
+			if (flt_buf != NULL) flt_buf->Close();
 			break;
 		}
 		if (rc < 0) {
@@ -560,23 +843,13 @@ void VideoCapture::PushAudioFrames_flt(){
 			snprintf(msg, sizeof(msg), "unable to get frame from filter: %s" , msg2);
 			throw AudioCaptureException(string(msg));
 		}
-		bool more = true;
-		float *buffer = circ_buf.fltsamples;
-		float *sample_data = (float*)(pframeAufiltered->data[0]);
-		unsigned long nbsamples = pframeAufiltered->nb_samples;
-		while (more){
-			while (audio_producer_flag.test_and_set(memory_order_acquire));
-			unsigned long head = circ_buf.head.load(memory_order_relaxed);
-			unsigned long tail = circ_buf.tail.load(memory_order_acquire);
-			if (CIRC_SPACE(head, tail, CircBufferSize) >= nbsamples){
-				for (int i=0;i<(int)nbsamples;i++){
-					buffer[head] = sample_data[i];
-					head = (head+1) & (CircBufferSize - 1);
-				}
-				circ_buf.head.store(head, memory_order_release);
-				more = false;
-			}
-			audio_producer_flag.clear(memory_order_release);
+		if (fingerprinter != NULL)
+			FingerprintAudio(pframeAufiltered);
+		if (on_audio_samples){
+			DeliverAudioSamples();
+		} else if (flt_buf != NULL && !(capture_flag & PHCAPTURE_AUDIOFPONLY_FLAG)){
+			unsigned long n = flt_buf->Write((float*)(pframeAufiltered->data[0]), pframeAufiltered->nb_samples);
+			counters.audio_samples.fetch_add(n, memory_order_relaxed);
 		}
 		av_frame_unref(pframeAufiltered);
 	}
@@ -586,10 +859,12 @@ void VideoCapture::PushAudioFrames_s16(){
 	char msg[64];
 	char msg2[32];
 	while (true){
+		uint64_t start = now_ns();
 		int rc = av_buffersink_get_frame(abuffersink_ctx, pframeAufiltered);
+		add_elapsed(counters.audio_filter_ns, start);
 		if (rc == AVERROR(EAGAIN)) break;
 		if (rc == AVERROR_EOF){
-			stop_flag.store(true, memory_order_release);
+			if (s16_buf != NULL) s16_buf->Close();
 			break;
 		}
 		if (rc < 0) {
@@ -597,28 +872,58 @@ void VideoCapture::PushAudioFrames_s16(){
 			snprintf(msg, sizeof(msg), "unable to get frame from filter: %s" , msg2);
 			throw AudioCaptureException(string(msg));
 		}
-		int16_t *buffer = circ_buf.s16samples;
-		int16_t *sample_data = (int16_t*)(pframeAufiltered->data[0]);
-		unsigned long nbsamples = pframeAufiltered->nb_samples;
-		bool more = true;
-		while (more){
-			while (audio_producer_flag.test_and_set(memory_order_acquire));
-			unsigned long head = circ_buf.head.load(memory_order_relaxed);
-			unsigned long tail = circ_buf.tail.load(memory_order_acquire);
-			if (CIRC_SPACE(head, tail, CircBufferSize) >= nbsamples){
-				for (int i=0;i<(int)nbsamples;i++){
-					buffer[head] = sample_data[i];
-					head = (head+1) & (CircBufferSize - 1);
-				}
-				circ_buf.head.store(head, memory_order_release);
-				more = false;
-			}
-			audio_producer_flag.clear(memory_order_release);
+		if (fingerprinter != NULL)
+			FingerprintAudio(pframeAufiltered);
+		if (on_audio_samples){
+			DeliverAudioSamples();
+		} else if (s16_buf != NULL && !(capture_flag & PHCAPTURE_AUDIOFPONLY_FLAG)){
+			unsigned long n = s16_buf->Write((int16_t*)(pframeAufiltered->data[0]), pframeAufiltered->nb_samples);
+			counters.audio_samples.fetch_add(n, memory_order_relaxed);
 		}
 		av_frame_unref(pframeAufiltered);
 	}
 }
 
+void VideoCapture::FingerprintAudio(const AVFrame *frame){
+	char msg[64];
+	char msg2[32];
+	int rc;
+	if (!fingerprint_started){
+		int64_t pts = 0;
+		if (frame->pts != AV_NOPTS_VALUE)
+			pts = av_rescale_q(frame->pts, av_buffersink_get_time_base(abuffersink_ctx),
+							   av_make_q(1, sr));
+		fingerprinter->Reset(pts);
+		fingerprint_started = true;
+	}
+	if (flt_fmt)
+		fingerprinter->Add((const float*)frame->data[0], frame->nb_samples, fingerprints);
+	else
+		fingerprinter->Add((const int16_t*)frame->data[0], frame->nb_samples, fingerprints);
+	for (const AudioFingerprint &fp : fingerprints){
+		if ((rc = fingerprint_queue->Send(fp)) < 0){
+			fingerprints.clear();
+			if (stop_requested.load())
+				return;
+			av_strerror(rc, msg2, sizeof(msg2));
+			snprintf(msg, sizeof(msg), "unable to push audio fingerprint onto queue: %s", msg2);
+			throw AudioCaptureException(string(msg));
+		}
+	}
+	fingerprints.clear();
+}
+
+/** pframeAufiltered to on_audio_samples; unref'd by the caller **/
+void VideoCapture::DeliverAudioSamples(){
+	try {
+		on_audio_samples(pframeAufiltered);
+	} catch (...){
+		av_frame_unref(pframeAufiltered);
+		throw;
+	}
+	counters.audio_samples.fetch_add(pframeAufiltered->nb_samples, memory_order_relaxed);
+}
+
 void VideoCapture::PushAudioFrames(){
 	if (flt_fmt) PushAudioFrames_flt();
 	else PushAudioFrames_s16();
@@ -627,36 +932,42 @@ void VideoCapture::PushAudioFrames(){
 void VideoCapture::HandleAudioPacket(AVPacket &pkt){
 	char msg[64];
 	char msg2[32];
-	int rc, done = 0;
-
-        rc = avcodec_receive_frame(adec_ctx, pframeAu);
-
-        if (rc == 0) {
-            done = 1;
-        }
-
-        rc = avcodec_send_packet(adec_ctx, &pkt);
-
-        if(rc < 0) {
-            av_strerror(rc, msg2, sizeof(msg2));
-            snprintf(msg, sizeof(msg), "unable to decode audio frame: %s", msg2);
-            throw VideoCaptureException(string(msg));
-        }
-        else
-           rc = pkt.size;
-
-
-	pkt.size -= rc;
-	pkt.data += rc;
-	if (done) {
+	int rc;
+	uint64_t start = now_ns();
+	rc = avcodec_send_packet(adec_ctx, (pkt.data != NULL) ? &pkt : NULL);
+	add_elapsed(counters.audio_decode_ns, start);
+	if (rc < 0 && rc != AVERROR_EOF){
+		av_strerror(rc, msg2, sizeof(msg2));
+		snprintf(msg, sizeof(msg), "unable to decode audio frame: %s", msg2);
+		throw AudioCaptureException(string(msg));
+	}
+	while (true){
+		start = now_ns();
+		rc = avcodec_receive_frame(adec_ctx, pframeAu);
+		add_elapsed(counters.audio_decode_ns, start);
+		if (rc == AVERROR(EAGAIN) || rc == AVERROR_EOF) break;
+		if (rc < 0){
+			av_strerror(rc, msg2, sizeof(msg2));
+			snprintf(msg, sizeof(msg), "unable to decode audio frame: %s", msg2);
+			throw AudioCaptureException(string(msg));
+		}
 #ifndef FF_API_FRAME_GET_SET
-            pframeAu->pts = av_frame_get_best_effort_timestamp(pframeAu);
+		pframeAu->pts = av_frame_get_best_effort_timestamp(pframeAu);
 #else
-            pframeAu->pts = pframeAu->best_effort_timestamp;
+		pframeAu->pts = pframeAu->best_effort_timestamp;
 #endif
-
-		if ((rc = av_buffersrc_add_frame_flags(abuffersrc_ctx, pframeAu,
-											   AV_BUFFERSRC_FLAG_KEEP_REF)) < 0){
+		if (use_range && pframeAu->pts != AV_NOPTS_VALUE){
+			int64_t dur = av_rescale_q(pframeAu->nb_samples, av_make_q(1, pframeAu->sample_rate),
+									   fmt_ctx->streams[audio_stream]->time_base);
+			if (!InRange(1, pframeAu->pts, dur)){
+				av_frame_unref(pframeAu);
+				continue;
+			}
+		}
+		start = now_ns();
+		rc = av_buffersrc_add_frame_flags(abuffersrc_ctx, pframeAu, AV_BUFFERSRC_FLAG_KEEP_REF);
+		add_elapsed(counters.audio_filter_ns, start);
+		if (rc < 0){
 			av_strerror(rc, msg2, sizeof(msg2));
 			snprintf(msg, sizeof(msg), "Unable to add frame to audio filter: %s" , msg2);
 			throw AudioCaptureException(string(msg));
@@ -664,39 +975,78 @@ void VideoCapture::HandleAudioPacket(AVPacket &pkt){
 		av_frame_unref(pframeAu);
 		PushAudioFrames();
 	}
-	
 }										  
 
+/** hand a decoded subtitle to the queue according to subtitle_queue_policy
+ *  takes ownership of sub
+ **/
+void VideoCapture::QueueSubtitle(AVSubtitle *sub){
+	char msg[64];
+	char msg2[32];
+	if (on_subtitle){
+		try {
+			on_subtitle(sub);
+		} catch (...){
+			avsubtitle_free(sub);
+			free(sub);
+			throw;
+		}
+		avsubtitle_free(sub);
+		free(sub);
+		counters.subtitles.fetch_add(1, memory_order_relaxed);
+		return;
+	}
+	int policy = options.subtitle_queue_policy;
+	bool wait = policy == PHQUEUE_BLOCK || policy == PHQUEUE_DROP_NONKEY;
+	int rc;
+	while ((rc = subtitle_queue->Send(sub, (wait) ? -1 : 0)) == AVERROR(EAGAIN)){
+		AVSubtitle *old = NULL;
+		counters.subtitles_dropped.fetch_add(1, memory_order_relaxed);
+		if (policy != PHQUEUE_DROP_OLDEST || subtitle_queue->Recv(old, 0) < 0){
+			avsubtitle_free(sub);
+			free(sub);
+			return;
+		}
+		avsubtitle_free(old);
+		free(old);
+	}
+	if (rc < 0){
+		avsubtitle_free(sub);
+		free(sub);
+		if (stop_requested.load())
+			return;
+		av_strerror(rc, msg2, sizeof(msg2));
+		snprintf(msg, sizeof(msg), "unable to push subtitle onto queue: %s", msg2);
+		throw VideoCaptureException(string(msg));
+	}
+	counters.subtitles.fetch_add(1, memory_order_relaxed);
+}
+
 void VideoCapture::HandleSubtitlePacket(AVPacket &pkt){
-	static AVSubtitle *subtitle = NULL;
-	if (subtitle == NULL) subtitle = new AVSubtitle();
+	if (!InRange(2, pkt.pts, pkt.duration))
+		return;
+	// consumers release subtitles with avsubtitle_free() and free()
+	AVSubtitle *subtitle = (AVSubtitle*)calloc(1, sizeof(AVSubtitle));
+	if (subtitle == NULL)
+		throw VideoCaptureException("unable to alloc subtitle");
 
 	char msg[64];
-	char msg2[32];
 	int rc, done = 0;
-	if ((rc = avcodec_decode_subtitle2(subdec_ctx, subtitle, &done, &pkt)) < 0){
+	uint64_t start = now_ns();
+	rc = avcodec_decode_subtitle2(subdec_ctx, subtitle, &done, &pkt);
+	add_elapsed(counters.subtitle_decode_ns, start);
+	if (rc < 0){
+		free(subtitle);
 		av_strerror(rc, msg, sizeof(msg));
 		throw VideoCaptureException(string(msg));
 	}
 	pkt.size -= rc;
 	pkt.data += rc;
-	if (done){
-		while (true){
-			if ((rc = av_thread_message_queue_send(subtitle_queue, (void*)&subtitle, 0)) < 0){
-				if (rc == AVERROR(EAGAIN)){
-					av_log(NULL, AV_LOG_ERROR, "subtitle queue overrun");
-					break;
-				}
-				if (rc < 0){
-					av_strerror(AVERROR(rc), msg2, sizeof(msg2));
-					snprintf(msg, sizeof(msg), "error adding audio frame to queue: %s", msg2);
-					throw AudioCaptureException(string(msg));
-				}
-			}
-		    subtitle = NULL;
-			break;
-		}
+	if (!done){
+		free(subtitle);
+		return;
 	}
+	QueueSubtitle(subtitle);
 }
 
 VideoCapture::VideoCapture(){
@@ -708,7 +1058,6 @@ VideoCapture::VideoCapture(){
 	subtitle_stream = -1;
 	subdec_ctx = NULL;
 	subtitle_queue = NULL;
-	circ_buf.fltsamples = NULL;
 }
 
 VideoCapture::VideoCapture(const string &filename,
@@ -716,35 +1065,102 @@ VideoCapture::VideoCapture(const string &filename,
 						   int left_m, int right_m,
 						   int sr, int width,
 						   int flag, int flt_fmt, int fps, bool warn){
-	VideoCapture();
-	this->flt_fmt = flt_fmt;
-	this->sr = sr;
-	RegisterInit(warn);
-	OpenFile(filename);
-	InitMetaData();
-	if (flag & PHCAPTURE_VIDEO_FLAG){
-		InitVideoCodec();
-		InitVideoFilters(top_m, bottom_m, left_m, right_m, width, fps);
+	CaptureOptions opts;
+	opts.top_m = top_m;
+	opts.bottom_m = bottom_m;
+	opts.left_m = left_m;
+	opts.right_m = right_m;
+	opts.sr = sr;
+	opts.width = width;
+	opts.flag = flag;
+	opts.flt_fmt = flt_fmt;
+	opts.fps = fps;
+	opts.warn = warn;
+	Open(filename, NULL, opts);
+}
+
+VideoCapture::VideoCapture(const string &filename, const CaptureOptions &opts){
+	Open(filename, NULL, opts);
+}
+
+VideoCapture::VideoCapture(InputSource &source, const CaptureOptions &opts){
+	Open(string(), &source, opts);
+}
+
+VideoCapture::VideoCapture(const string &filename, const CaptureOptions &opts, bool budgeted)
+	:budgeted(budgeted){
+	Open(filename, NULL, opts);
+}
+
+void VideoCapture::Open(const string &filename, InputSource *source, const CaptureOptions &opts){
+	options = opts;
+	this->filename = filename;
+	capture_flag = opts.flag;
+	flt_fmt = opts.flt_fmt;
+	sr = opts.sr;
+	if (budgeted){
+		nb_captures++;
+		counted = true;
 	}
-	if (flag & PHCAPTURE_AUDIO_FLAG){
-		InitAudioCodec();
-		InitAudioFilters(sr, flt_fmt);
+	try {
+		RegisterInit(opts.warn);
+		if (source != NULL)
+			OpenSource(source);
+		else
+			OpenFile(filename);
+		InitMetaData();
+		if (opts.flag & PHCAPTURE_VIDEO_FLAG){
+			InitVideoCodec();
+			InitVideoFilters(opts.top_m, opts.bottom_m, opts.left_m, opts.right_m, opts.width, opts.fps);
+		}
+		if (opts.flag & PHCAPTURE_AUDIO_FLAG){
+			InitAudioCodec();
+			InitAudioFilters(opts.sr, opts.flt_fmt);
+		}
+		if (opts.flag & PHCAPTURE_SUBTITLE_FLAG){
+			InitSubtitleCodec();
+		}
+		if (opts.flag & PHCAPTURE_ALL_FLAG){
+			DiscardUnusedStreams();
+			if (!(opts.flag & PHCAPTURE_SYNC_FLAG))
+				InitMsgQueues();
+		}
+	} catch (...){
+		// dtor does not run when a ctor throws
+		Close();
+		throw;
 	}
-	if (flag & PHCAPTURE_SUBTITLE_FLAG){
-		InitSubtitleCodec();
+}
+
+/** let the demuxer skip streams that are not captured, e.g. extra audio tracks **/
+void VideoCapture::DiscardUnusedStreams(){
+	for (unsigned int i=0;i<fmt_ctx->nb_streams;i++){
+		int index = (int)i;
+		if (index != video_stream && index != audio_stream && index != subtitle_stream)
+			fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
 	}
-	if (flag) InitMsgQueues();
 }
 
 VideoCapture::~VideoCapture(){
 	Close();
 }
 
+int VideoCapture::ReadPacket(AVPacket *pkt){
+	uint64_t start = now_ns();
+	int rc = av_read_frame(fmt_ctx, pkt);
+	add_elapsed(counters.read_ns, start);
+	if (rc >= 0){
+		counters.packets_read.fetch_add(1, memory_order_relaxed);
+		counters.bytes_read.fetch_add(pkt->size, memory_order_relaxed);
+	}
+	return rc;
+}
+
 int VideoCapture::NextPacket(AVPacket &pkt){
 	int rc = 0;
 	av_init_packet(&pkt);
 	while (true){
-		rc = av_read_frame(fmt_ctx, &pkt);
+		rc = ReadPacket(&pkt);
 		if (rc == AVERROR(EAGAIN)) continue;
 		if (rc < 0) break;
 		if (pkt.stream_index == video_stream) break;
@@ -753,16 +1169,84 @@ int VideoCapture::NextPacket(AVPacket &pkt){
 }
 
 uint32_t VideoCapture::CountVideoPackets(){
-	int rc;
+	int method;
+	bool exact;
+	return CountVideoPackets(method, exact, false);
+}
+
+uint32_t VideoCapture::CountVideoPackets(int &method, bool &exact, bool allow_estimate){
+	if (video_stream < 0){
+		method = PHCOUNT_NONE;
+		exact = true;
+		return 0;
+	}
+	AVStream *st = fmt_ctx->streams[video_stream];
+
+	// duration x frame rate, also used to check index completeness
+	int64_t estimate = -1;
+	AVRational rate = (st->avg_frame_rate.num > 0) ? st->avg_frame_rate : st->r_frame_rate;
+	if (rate.num > 0 && rate.den > 0){
+		if (st->duration != AV_NOPTS_VALUE && st->duration > 0)
+			estimate = av_rescale_q(st->duration, st->time_base, av_inv_q(rate));
+		else if (fmt_ctx->duration != AV_NOPTS_VALUE && fmt_ctx->duration > 0)
+			estimate = av_rescale_q(fmt_ctx->duration, AV_TIME_BASE_Q, av_inv_q(rate));
+	}
+
+	// frame count from stream header
+	if (st->nb_frames > 0){
+		method = PHCOUNT_NB_FRAMES;
+		exact = true;
+		return (uint32_t)st->nb_frames;
+	}
+
+	// index, provided it holds every packet and not just key frames (e.g. mkv cues)
+	int nb_entries = index_entries_count(st);
+	if (nb_entries > 0){
+		bool has_nonkey = false;
+		for (int i=0;i<nb_entries && !has_nonkey;i++){
+			const AVIndexEntry *entry = index_entry(st, i);
+			if (entry != NULL && !(entry->flags & AVINDEX_KEYFRAME))
+				has_nonkey = true;
+		}
+		bool covers = estimate > 0 && llabs(nb_entries - estimate) <= estimate/100 + 2;
+		if (has_nonkey || covers){
+			method = PHCOUNT_INDEX;
+			exact = true;
+			return (uint32_t)nb_entries;
+		}
+	}
+
+	if (allow_estimate && estimate > 0){
+		method = PHCOUNT_DURATION;
+		exact = false;
+		return (uint32_t)estimate;
+	}
+
+	method = PHCOUNT_SCAN;
+	exact = true;
+	return CountVideoPacketsScan();
+}
+
+uint32_t VideoCapture::CountVideoPacketsScan(){
+	int rc;
 	char msg[64];
 	char submsg[32];
 	uint32_t count = 0;
 	AVPacket pkt;
+	av_init_packet(&pkt);
+	pkt.data = NULL;
+	pkt.size = 0;
+
+	// every packet, also when key frame capture discards the others
+	AVStream *st = fmt_ctx->streams[video_stream];
+	enum AVDiscard discard = st->discard;
+	st->discard = AVDISCARD_DEFAULT;
 	while (true){
 		rc = av_read_frame(fmt_ctx, &pkt);
 		if (rc == AVERROR(EAGAIN)) continue;
 		if (rc == AVERROR_EOF) break;
 		if (rc < 0){
+			st->discard = discard;
 			av_strerror(AVERROR(rc), submsg, sizeof(submsg));
 			snprintf(msg, sizeof(msg), "unable to read packet: %s", submsg);
 			throw VideoCaptureException(string(msg));
@@ -771,6 +1255,7 @@ uint32_t VideoCapture::CountVideoPackets(){
 			count++;
 		av_packet_unref(&pkt);
 	}
+	st->discard = discard;
 
 	avio_flush(fmt_ctx->pb);
 	if ((rc = avformat_flush(fmt_ctx)) < 0){
@@ -786,71 +1271,898 @@ uint32_t VideoCapture::CountVideoPackets(){
 	return count;
 }
 
+bool VideoCapture::SkipPacket(const AVPacket &pkt){
+	if (use_range){
+		// nothing more to decode once a stream is past the end
+		if ((pkt.stream_index == video_stream && range_done[0].load(memory_order_relaxed))
+			|| (pkt.stream_index == audio_stream && range_done[1].load(memory_order_relaxed)))
+			return true;
+	}
+	if (pkt.stream_index == video_stream){
+		// not every demuxer honors AVDISCARD_NONKEY
+		if ((capture_flag & PHCAPTURE_KEYFRAME_FLAG) && !(pkt.flags & AV_PKT_FLAG_KEY))
+			return true;
+		return false;
+	}
+	return pkt.stream_index != audio_stream && pkt.stream_index != subtitle_stream;
+}
+
+void VideoCapture::DispatchPacket(AVPacket &pkt){
+	if (pkt.stream_index == video_stream){
+		HandleVideoPacket(pkt);
+	} else if (pkt.stream_index == audio_stream){
+		HandleAudioPacket(pkt);
+	} else if (pkt.stream_index == subtitle_stream){
+		HandleSubtitlePacket(pkt);
+	}
+}
+
 void VideoCapture::Process(int64_t secs){
-	AVRational fr = fmt_ctx->streams[video_stream]->avg_frame_rate;
+	if (capture_flag & PHCAPTURE_SYNC_FLAG)
+		throw VideoCaptureException("no Process() with PHCAPTURE_SYNC_FLAG");
+	if (capture_flag & PHCAPTURE_PIPELINE_FLAG){
+		ProcessPipelined(secs);
+		return;
+	}
+	int nb_threads = SegmentThreads(secs);
+	if (nb_threads > 1){
+		try {
+			ProcessSegmented(nb_threads);
+		} catch (...){
+			ReleaseThreads(nb_threads);
+			throw;
+		}
+		ReleaseThreads(nb_threads);
+		return;
+	}
 	int64_t frame_count = 0;
-	int64_t total_frames = av_rescale(secs, fr.num, fr.den);
+	int64_t total_frames = 0;
+	if (secs > 0 && video_stream >= 0){
+		AVRational fr = fmt_ctx->streams[video_stream]->avg_frame_rate;
+		total_frames = av_rescale(secs, fr.num, fr.den);
+	}
 	
-	AVPacket pkt, pkt0;
+	AVPacket pkt;
 	av_init_packet(&pkt);
 	pkt.data = NULL;
 	pkt.size = 0;
-	av_init_packet(&pkt0);
-	pkt0.data = NULL;
-	pkt0.size = 0;
 	int rc;
-	bool done = false;
-	while (!done){
-		if (pkt0.data == NULL){
-			if ((rc = av_read_frame(fmt_ctx, &pkt)) < 0){
-				if (rc == AVERROR(EAGAIN))continue;
+	try {
+		while (true){
+			if ((rc = ReadPacket(&pkt)) < 0){
+				if (rc == AVERROR(EAGAIN)) continue;
 				if (rc == AVERROR_EOF){
 					FlushFrames();
 					break;
 				}
 				throw VideoCaptureException("unable to read packet");
 			}
-			pkt0 = pkt;
-		}
-		if (pkt.stream_index == video_stream){
-			HandleVideoPacket(pkt);
-			frame_count++;
-		} else if (pkt.stream_index == audio_stream){
-			HandleAudioPacket(pkt);
-		} else if (pkt.stream_index == subtitle_stream){
-			HandleSubtitlePacket(pkt);
+			if (pkt.stream_index == video_stream)
+				frame_count++;
+			if (!SkipPacket(pkt))
+				DispatchPacket(pkt);
+			av_packet_unref(&pkt);
+			if (stop_requested.load(memory_order_relaxed)){
+				SignalEndOfStream();
+				break;
+			}
+			if ((total_frames > 0 && frame_count >= total_frames) || RangeDone()){
+				FlushFrames();
+				break;
+			}
+		}
+	} catch (...){
+		// wake consumers blocked in Pull* functions
+		av_packet_unref(&pkt);
+		SignalEndOfStream();
+		throw;
+	}
+}
+
+void VideoCapture::Process(int64_t start, int64_t end){
+	try {
+		SeekRange(start, end);
+	} catch (...){
+		SignalEndOfStream();
+		throw;
+	}
+	Process();
+}
+
+void VideoCapture::SeekRange(int64_t start, int64_t end){
+	char msg[64];
+	char msg2[32];
+	int rc;
+	int64_t origin = (fmt_ctx->start_time != AV_NOPTS_VALUE) ? fmt_ctx->start_time : 0;
+	if (start > 0){
+		// key frame at or before start, in the default (video) stream
+		if ((rc = avformat_seek_file(fmt_ctx, -1, INT64_MIN, origin + start, origin + start, 0)) < 0){
+			av_strerror(rc, msg2, sizeof(msg2));
+			snprintf(msg, sizeof(msg), "unable to seek to start: %s", msg2);
+			throw VideoCaptureException(string(msg));
+		}
+		if (dec_ctx != NULL) avcodec_flush_buffers(dec_ctx);
+		if (adec_ctx != NULL) avcodec_flush_buffers(adec_ctx);
+		if (subdec_ctx != NULL) avcodec_flush_buffers(subdec_ctx);
+	}
+	int streams[3] = { video_stream, audio_stream, subtitle_stream };
+	for (int i=0;i<3;i++){
+		range_done[i].store(false, memory_order_relaxed);
+		if (streams[i] < 0) continue;
+		AVRational tb = fmt_ctx->streams[streams[i]]->time_base;
+		range_start[i] = av_rescale_q(origin + start, AV_TIME_BASE_Q, tb);
+		range_end[i] = (end != AV_NOPTS_VALUE && end > start)
+			? av_rescale_q(origin + end, AV_TIME_BASE_Q, tb) : AV_NOPTS_VALUE;
+	}
+	use_range = true;
+}
+
+/** whether a frame of stream id (0 video, 1 audio, 2 subtitle) overlaps
+ *  the Process(start, end) window; marks the stream done past the end
+ **/
+bool VideoCapture::InRange(int id, int64_t pts, int64_t duration){
+	if (!use_range || pts == AV_NOPTS_VALUE)
+		return true;
+	if (range_end[id] != AV_NOPTS_VALUE && pts >= range_end[id]){
+		range_done[id].store(true, memory_order_relaxed);
+		return false;
+	}
+	return pts + max(duration, (int64_t)1) > range_start[id];
+}
+
+/** every stream that decides has passed the end of the window **/
+bool VideoCapture::RangeDone(){
+	if (!use_range) return false;
+	if (video_stream < 0 && audio_stream < 0)
+		return subtitle_stream >= 0 && range_done[2].load(memory_order_relaxed);
+	return (video_stream < 0 || range_done[0].load(memory_order_relaxed))
+		&& (audio_stream < 0 || range_done[1].load(memory_order_relaxed));
+}
+
+/* video pts window [start, end) decoded by one segment thread */
+typedef struct ph::video_segment {
+	int64_t start = INT64_MIN;       // INT64_MIN from start of stream
+	int64_t end = AV_NOPTS_VALUE;    // AV_NOPTS_VALUE to end of stream
+	vector<AVFrame*> frames;
+	vector<HashRecord> hashes;
+	bool done = false;
+} VideoSegment;
+
+static const double SegmentSecs = 2.0;
+
+/** no. threads for segmented decoding, reserved from the core budget;
+ *  1, with nothing reserved, when it does not apply
+ **/
+int VideoCapture::SegmentThreads(int64_t secs){
+	int nb_threads = options.segment_threads;
+	// video only, from a reopenable file, whole of it, at the source frame rate
+	if ((nb_threads <= 1 && nb_threads != PHTHREADS_AUTO) || video_stream < 0 || filename.empty() || secs > 0 || use_range
+		|| (capture_flag & (PHCAPTURE_AUDIO_FLAG|PHCAPTURE_SUBTITLE_FLAG|PHCAPTURE_PIPELINE_FLAG))
+		|| (options.fps > 0 && use_fps_filter))
+		return 1;
+	nb_threads = ReserveThreads(nb_threads);
+	if (nb_threads <= 1){
+		ReleaseThreads(nb_threads);
+		return 1;
+	}
+	return nb_threads;
+}
+
+/** decode seg with this capture's own contexts
+ *  seeks to the key frame at or before seg.start and keeps the frames
+ *  with pts in [seg.start, seg.end); decoded output is in pts order, so
+ *  the frames of a segment and of the next one neither overlap nor leave gaps
+ **/
+void VideoCapture::DecodeSegment(VideoSegment &seg, bool hash, bool keep_frames){
+	char msg[64];
+	char msg2[32];
+	const int MaxSeekTries = 8;
+	int rc = 0;
+	AVStream *st = fmt_ctx->streams[video_stream];
+	int64_t target = (seg.start != INT64_MIN) ? seg.start
+		: (st->start_time != AV_NOPTS_VALUE) ? st->start_time : 0;
+	int64_t backoff = 0;
+	AVRational tb = st->time_base;   // of decoded frames
+
+	AVFrame *frame = av_frame_alloc();
+	if (frame == NULL)
+		throw VideoCaptureException("unable to allocate frame");
+	try {
+		for (int tries=0;tries<MaxSeekTries;tries++){
+			if ((rc = avformat_seek_file(fmt_ctx, video_stream, INT64_MIN, target - backoff,
+										 target - backoff, 0)) < 0){
+				av_strerror(rc, msg2, sizeof(msg2));
+				snprintf(msg, sizeof(msg), "unable to seek to segment: %s", msg2);
+				throw VideoCaptureException(string(msg));
+			}
+			avcodec_flush_buffers(dec_ctx);
+			ResetVideoFilters();
+			// filters may change the time base, e.g. yadif
+			tb = (bypass_video_filters) ? st->time_base : GetVideoTimebase();
+			rc = DecodeVideoFrame(frame);
+
+			// inexact seek landed past the start; frames would go missing
+			if (rc == 0 && seg.start != INT64_MIN && frame->pts != AV_NOPTS_VALUE
+				&& av_rescale_q(frame->pts, tb, st->time_base) > seg.start
+				&& tries < MaxSeekTries - 1){
+				av_frame_unref(frame);
+				backoff = (backoff > 0) ? 2*backoff : av_rescale_q(AV_TIME_BASE, AV_TIME_BASE_Q, st->time_base);
+				continue;
+			}
+			break;
+		}
+
+		int64_t start = (seg.start != INT64_MIN) ? av_rescale_q(seg.start, st->time_base, tb) : INT64_MIN;
+		int64_t end = (seg.end != AV_NOPTS_VALUE) ? av_rescale_q(seg.end, st->time_base, tb) : AV_NOPTS_VALUE;
+		bool started = seg.start == INT64_MIN;
+		while (rc == 0){
+			if (frame->pts != AV_NOPTS_VALUE){
+				if (end != AV_NOPTS_VALUE && frame->pts >= end)
+					break;
+				started = started || frame->pts >= start;
+			}
+			if (started){
+				if (hash){
+					HashRecord rec;
+					rec.pts = frame->pts;
+					rec.phash = PHash(frame->data[0], frame->linesize[0], frame->width, frame->height);
+					rec.bmhash = BlockMeanHash(frame->data[0], frame->linesize[0], frame->width, frame->height);
+					seg.hashes.push_back(rec);
+				}
+				if (keep_frames){
+					seg.frames.push_back(frame);
+					if ((frame = av_frame_alloc()) == NULL)
+						throw VideoCaptureException("unable to allocate frame");
+				}
+			}
+			av_frame_unref(frame);
+			rc = DecodeVideoFrame(frame);
+		}
+	} catch (...){
+		av_frame_free(&frame);
+		throw;
+	}
+	av_frame_free(&frame);
+}
+
+void VideoCapture::ProcessSegmented(int nb_threads){
+	AVStream *st = fmt_ctx->streams[video_stream];
+	int64_t start_ts = (st->start_time != AV_NOPTS_VALUE) ? st->start_time : 0;
+	int64_t duration = st->duration;
+	if (duration == AV_NOPTS_VALUE || duration <= 0){
+		duration = (fmt_ctx->duration != AV_NOPTS_VALUE)
+			? av_rescale_q(fmt_ctx->duration, AV_TIME_BASE_Q, st->time_base) : 0;
+	}
+
+	// boundaries at indexed key frames where there are any, else evenly spaced
+	vector<VideoSegment> segs(1);
+	int nb_segs = max(nb_threads, (int)(duration*av_q2d(st->time_base)/SegmentSecs));
+	for (int i=1;duration > 0 && i<nb_segs;i++){
+		int64_t t = start_ts + av_rescale(duration, i, nb_segs);
+		int64_t key = keyframe_before(st, t);
+		if (key != AV_NOPTS_VALUE) t = key;
+		if (t <= start_ts || (segs.size() > 1 && t <= segs.back().start))
+			continue;
+		segs.back().end = t;
+		segs.push_back(VideoSegment());
+		segs.back().start = t;
+	}
+
+	bool hash = hash_queue != NULL;
+	bool keep_frames = !(capture_flag & PHCAPTURE_HASHONLY_FLAG);
+	CaptureOptions seg_opts = options;
+	seg_opts.flag = PHCAPTURE_VIDEO_FLAG | (capture_flag & PHCAPTURE_KEYFRAME_FLAG);
+	if (capture_flag & PHCAPTURE_HASHONLY_FLAG)
+		seg_opts.pix_fmt = PHPIXFMT_GRAY8;
+	seg_opts.segment_threads = 0;
+	seg_opts.video_threads = 1;    // segments replace decoder threads
+
+	// threads stay within a window of segments ahead of the one being queued
+	mutex mtx;
+	condition_variable cond;
+	size_t next_claim = 0, next_queue = 0;
+	const size_t window = 2*nb_threads;
+	bool abort = false;
+	exception_ptr ex;
+
+	auto run = [&](){
+		VideoCapture *vc = NULL;
+		try {
+			// within the nb_threads SegmentThreads() reserved
+			vc = new VideoCapture(filename, seg_opts, false);
+			while (true){
+				size_t i;
+				{
+					unique_lock<mutex> lck(mtx);
+					cond.wait(lck, [&]{ return abort || next_claim >= segs.size()
+								|| next_claim < next_queue + window; });
+					if (abort || next_claim >= segs.size()) break;
+					i = next_claim++;
+				}
+				vc->DecodeSegment(segs[i], hash, keep_frames);
+				lock_guard<mutex> lck(mtx);
+				segs[i].done = true;
+				cond.notify_all();
+			}
+		} catch (...){
+			lock_guard<mutex> lck(mtx);
+			if (!ex) ex = current_exception();
+			abort = true;
+			cond.notify_all();
+		}
+		if (vc != NULL){
+			counters.packets_read.fetch_add(vc->counters.packets_read.load(memory_order_relaxed), memory_order_relaxed);
+			counters.bytes_read.fetch_add(vc->counters.bytes_read.load(memory_order_relaxed), memory_order_relaxed);
+			counters.read_ns.fetch_add(vc->counters.read_ns.load(memory_order_relaxed), memory_order_relaxed);
+			counters.video_decode_ns.fetch_add(vc->counters.video_decode_ns.load(memory_order_relaxed), memory_order_relaxed);
+			counters.video_filter_ns.fetch_add(vc->counters.video_filter_ns.load(memory_order_relaxed), memory_order_relaxed);
+			delete vc;
+		}
+	};
+	vector<thread> threads;
+	for (int i=0;i<nb_threads && i<(int)segs.size();i++)
+		threads.push_back(thread(run));
+
+	// queue segments in order as they complete
+	try {
+		for (size_t i=0;i<segs.size();i++){
+			{
+				unique_lock<mutex> lck(mtx);
+				cond.wait(lck, [&]{ return abort || segs[i].done; });
+				if (!segs[i].done) break;
+			}
+			VideoSegment &seg = segs[i];
+			for (size_t j=0;j<seg.frames.size();j++){
+				av_frame_move_ref(pframe_filtered, seg.frames[j]);
+				av_frame_free(&seg.frames[j]);
+				if (!QueueVideoFrame((hash) ? &seg.hashes[j] : NULL))
+					break;
+			}
+			if (stop_requested.load())
+				break;
+			if (!keep_frames){
+				for (const HashRecord &rec : seg.hashes){
+					int rc;
+					if ((rc = hash_queue->Send(rec)) < 0){
+						if (stop_requested.load())
+							break;
+						char msg[64];
+						char msg2[32];
+						av_strerror(rc, msg2, sizeof(msg2));
+						snprintf(msg, sizeof(msg), "unable to push frame hash onto queue: %s", msg2);
+						throw VideoCaptureException(string(msg));
+					}
+				}
+			}
+			seg.hashes.clear();
+			lock_guard<mutex> lck(mtx);
+			next_queue = i + 1;
+			cond.notify_all();
+		}
+	} catch (...){
+		lock_guard<mutex> lck(mtx);
+		if (!ex) ex = current_exception();
+		abort = true;
+		cond.notify_all();
+	}
+	{
+		lock_guard<mutex> lck(mtx);
+		abort = true;
+		cond.notify_all();
+	}
+	for (thread &thr : threads)
+		thr.join();
+	for (VideoSegment &seg : segs){
+		for (AVFrame *frame : seg.frames)
+			av_frame_free(&frame);
+	}
+	SignalEndOfStream();
+	if (ex) rethrow_exception(ex);
+}
+
+void VideoCapture::RunStreamWorker(MessageQueue<AVPacket*> *queue, exception_ptr &ex){
+	AVPacket *pkt = NULL;
+	int stream_id = (queue == video_pkt_queue) ? 0 : (queue == audio_pkt_queue) ? 1 : 2;
+	try {
+		while (queue->Recv(pkt) == 0){
+			counters.pkt_queue_depth[stream_id].fetch_sub(1, memory_order_relaxed);
+			DispatchPacket(*pkt);
+			av_packet_free(&pkt);
+		}
+		if (queue == video_pkt_queue)
+			FlushVideo();
+		else if (queue == audio_pkt_queue)
+			FlushAudio();
+	} catch (...){
+		ex = current_exception();
+		av_packet_free(&pkt);
+		// demuxer stops feeding this stream
+		queue->SetErrSend(AVERROR_EXIT);
+	}
+	while (queue->Recv(pkt, 0) == 0)
+		av_packet_free(&pkt);
+}
+
+void VideoCapture::ProcessPipelined(int64_t secs){
+	int64_t frame_count = 0;
+	int64_t total_frames = 0;
+	if (secs > 0 && video_stream >= 0){
+		AVRational fr = fmt_ctx->streams[video_stream]->avg_frame_rate;
+		total_frames = av_rescale(secs, fr.num, fr.den);
+	}
+
+	MessageQueue<AVPacket*> **queues[3] = { &video_pkt_queue, &audio_pkt_queue, &subtitle_pkt_queue };
+	int streams[3] = { video_stream, audio_stream, subtitle_stream };
+	thread workers[3];
+	exception_ptr worker_ex[3];
+	int nb_workers = 0;
+	for (int i=0;i<3;i++){
+		if (streams[i] < 0) continue;
+		*queues[i] = new MessageQueue<AVPacket*>(PacketQueueCapacity);
+		workers[i] = thread(&VideoCapture::RunStreamWorker, this, *queues[i], ref(worker_ex[i]));
+		nb_workers++;
+	}
+	ReserveThreads(nb_workers);
+
+	exception_ptr demux_ex;
+	AVPacket *pkt = NULL;
+	int rc;
+	try {
+		while (true){
+			if (pkt == NULL && (pkt = av_packet_alloc()) == NULL)
+				throw VideoCaptureException("unable to alloc packet");
+			if ((rc = ReadPacket(pkt)) < 0){
+				if (rc == AVERROR(EAGAIN)) continue;
+				if (rc == AVERROR_EOF) break;
+				throw VideoCaptureException("unable to read packet");
+			}
+			if (pkt->stream_index == video_stream)
+				frame_count++;
+			MessageQueue<AVPacket*> *queue = NULL;
+			int stream_id = 0;
+			for (int i=0;i<3;i++){
+				if (streams[i] >= 0 && pkt->stream_index == streams[i]){
+					queue = *queues[i];
+					stream_id = i;
+				}
+			}
+			if (queue == NULL || SkipPacket(*pkt)){
+				av_packet_unref(pkt);
+				if ((total_frames > 0 && frame_count >= total_frames) || RangeDone()
+					|| stop_requested.load(memory_order_relaxed))
+					break;
+				continue;
+			}
+			// blocks while the stream's worker is behind; fails if the worker quit
+			counters.pkt_queue_depth[stream_id].fetch_add(1, memory_order_relaxed);
+			if ((rc = queue->Send(pkt)) < 0){
+				counters.pkt_queue_depth[stream_id].fetch_sub(1, memory_order_relaxed);
+				break;
+			}
+			pkt = NULL;
+			if ((total_frames > 0 && frame_count >= total_frames) || RangeDone()
+				|| stop_requested.load(memory_order_relaxed))
+				break;
+		}
+	} catch (...){
+		demux_ex = current_exception();
+	}
+	av_packet_free(&pkt);
+
+	for (int i=0;i<3;i++){
+		if (*queues[i] == NULL) continue;
+		(*queues[i])->SetErrRecv(AVERROR_EOF);
+		workers[i].join();
+		delete *queues[i];
+		*queues[i] = NULL;
+		counters.pkt_queue_depth[i].store(0, memory_order_relaxed);
+	}
+	ReleaseThreads(nb_workers);
+	SignalEndOfStream();
+
+	if (demux_ex) rethrow_exception(demux_ex);
+	for (int i=0;i<3;i++){
+		if (worker_ex[i]) rethrow_exception(worker_ex[i]);
+	}
+}
+
+void VideoCapture::ResetVideoFilters(){
+	avfilter_graph_free(&filter_graph);
+	buffersrc_ctx = NULL;
+	buffersink_ctx = NULL;
+	InitVideoFilters(options.top_m, options.bottom_m, options.left_m, options.right_m,
+					 options.width, options.fps);
+}
+
+/** next packet of stream, holding back packets of the other captured
+ *  stream (video or audio) for the other Next* call
+ **/
+int VideoCapture::ReadStreamPacket(AVPacket *pkt, int stream){
+	deque<AVPacket*> &own = (stream == video_stream) ? video_pending : audio_pending;
+	deque<AVPacket*> &other = (stream == video_stream) ? audio_pending : video_pending;
+	int other_stream = (stream == video_stream) ? audio_stream : video_stream;
+	if (!own.empty()){
+		AVPacket *held = own.front();
+		own.pop_front();
+		av_packet_move_ref(pkt, held);
+		av_packet_free(&held);
+		return 0;
+	}
+	while (true){
+		int rc = ReadPacket(pkt);
+		if (rc < 0 || pkt->stream_index == stream)
+			return rc;
+		if (other_stream >= 0 && pkt->stream_index == other_stream){
+			AVPacket *held = av_packet_alloc();
+			if (held == NULL){
+				av_packet_unref(pkt);
+				throw VideoCaptureException("unable to alloc packet");
+			}
+			av_packet_move_ref(held, pkt);
+			other.push_back(held);
 		} else {
-			av_packet_unref(&pkt0);
+			av_packet_unref(pkt);
+		}
+	}
+}
+
+int VideoCapture::NextVideoFrame(AVFrame *frame){
+	if (dec_ctx == NULL)
+		throw VideoCaptureException("no video stream");
+	sync_mode = true;
+	int rc = DecodeVideoFrame(frame);
+	if (rc >= 0)
+		counters.video_frames.fetch_add(1, memory_order_relaxed);
+	return rc;
+}
+
+int VideoCapture::NextAudioChunk(AVFrame *frame){
+	if (adec_ctx == NULL)
+		throw AudioCaptureException("no audio stream");
+	sync_mode = true;
+	char msg[64];
+	char msg2[32];
+	int rc;
+	AVPacket pkt;
+	av_init_packet(&pkt);
+	pkt.data = NULL;
+	pkt.size = 0;
+	while (true){
+		uint64_t start = now_ns();
+		rc = av_buffersink_get_frame(abuffersink_ctx, frame);
+		add_elapsed(counters.audio_filter_ns, start);
+		if (rc >= 0){
+			counters.audio_samples.fetch_add(frame->nb_samples, memory_order_relaxed);
+			return 0;
 		}
-		if (pkt.size <= 0){
-			av_packet_unref(&pkt0);
+		if (rc == AVERROR_EOF)
+			return rc;
+		if (rc != AVERROR(EAGAIN)){
+			av_strerror(rc, msg2, sizeof(msg2));
+			snprintf(msg, sizeof(msg), "unable to get frame from filter: %s", msg2);
+			throw AudioCaptureException(string(msg));
+		}
+
+		start = now_ns();
+		rc = avcodec_receive_frame(adec_ctx, pframeAu);
+		add_elapsed(counters.audio_decode_ns, start);
+		if (rc >= 0){
+#ifndef FF_API_FRAME_GET_SET
+			pframeAu->pts = av_frame_get_best_effort_timestamp(pframeAu);
+#else
+			pframeAu->pts = pframeAu->best_effort_timestamp;
+#endif
+			start = now_ns();
+			rc = av_buffersrc_add_frame_flags(abuffersrc_ctx, pframeAu, 0);
+			add_elapsed(counters.audio_filter_ns, start);
+			if (rc < 0){
+				av_strerror(rc, msg2, sizeof(msg2));
+				snprintf(msg, sizeof(msg), "Unable to add frame to audio filter: %s", msg2);
+				throw AudioCaptureException(string(msg));
+			}
+			continue;
 		}
-		if (secs > 0 && frame_count >= total_frames){
-			FlushFrames();
-			done = true;
-			av_packet_unref(&pkt0);
+		if (rc == AVERROR_EOF){
+			// decoder drained; EOF to filter graph (repeat calls harmlessly fail)
+			av_buffersrc_add_frame_flags(abuffersrc_ctx, NULL, 0);
+			continue;
+		}
+		if (rc != AVERROR(EAGAIN)){
+			av_strerror(rc, msg2, sizeof(msg2));
+			snprintf(msg, sizeof(msg), "unable to decode audio frame: %s", msg2);
+			throw AudioCaptureException(string(msg));
+		}
+
+		// decoder wants more input
+		rc = ReadStreamPacket(&pkt, audio_stream);
+		if (rc == AVERROR(EAGAIN)) continue;
+		if (rc == AVERROR_EOF){
+			avcodec_send_packet(adec_ctx, NULL);
+			continue;
+		}
+		if (rc < 0){
+			av_strerror(rc, msg2, sizeof(msg2));
+			snprintf(msg, sizeof(msg), "unable to read packet: %s", msg2);
+			throw AudioCaptureException(string(msg));
+		}
+		start = now_ns();
+		rc = avcodec_send_packet(adec_ctx, &pkt);
+		add_elapsed(counters.audio_decode_ns, start);
+		av_packet_unref(&pkt);
+		if (rc < 0 && rc != AVERROR_EOF){
+			av_strerror(rc, msg2, sizeof(msg2));
+			snprintf(msg, sizeof(msg), "unable to decode audio frame: %s", msg2);
+			throw AudioCaptureException(string(msg));
 		}
 	}
 }
 
-AVFrame* VideoCapture::PullVideoFrame(){
-	if (video_frames_queue == NULL) return NULL;
+int VideoCapture::DecodeVideoFrame(AVFrame *frame){
 	char msg[64];
-	AVFrame *frame = NULL;
+	int rc;
+	AVPacket pkt;
+	av_init_packet(&pkt);
+	pkt.data = NULL;
+	pkt.size = 0;
 	while (true){
-		int rc = av_thread_message_queue_recv(video_frames_queue, &frame,
-											  AV_THREAD_MESSAGE_NONBLOCK);
-		if (AVERROR(rc) == EAGAIN) continue;
-		if (rc == AVERROR_EOF) break;
-		if (rc < 0) {
+		if (!bypass_video_filters){
+			if ((rc = av_buffersink_get_frame(buffersink_ctx, frame)) >= 0)
+				return 0;
+			if (rc == AVERROR_EOF)
+				return rc;
+			if (rc != AVERROR(EAGAIN)){
+				av_strerror(rc, msg, sizeof(msg));
+				throw VideoCaptureException(string(msg));
+			}
+		}
+
+		rc = avcodec_receive_frame(dec_ctx, pframe_decoded);
+		if (rc >= 0){
+#ifndef FF_API_FRAME_GET_SET
+			pframe_decoded->pts = av_frame_get_best_effort_timestamp(pframe_decoded);
+#else
+			pframe_decoded->pts = pframe_decoded->best_effort_timestamp;
+#endif
+			if (bypass_video_filters){
+				av_frame_move_ref(frame, pframe_decoded);
+				return 0;
+			}
+			if ((rc = av_buffersrc_add_frame_flags(buffersrc_ctx, pframe_decoded, 0)) < 0){
+				av_strerror(rc, msg, sizeof(msg));
+				throw VideoCaptureException(string(msg));
+			}
+			continue;
+		}
+		if (rc == AVERROR_EOF){
+			if (bypass_video_filters)
+				return rc;
+			// decoder drained; EOF to filter graph (repeat calls harmlessly fail)
+			av_buffersrc_add_frame_flags(buffersrc_ctx, NULL, 0);
+			continue;
+		}
+		if (rc != AVERROR(EAGAIN)){
+			av_strerror(rc, msg, sizeof(msg));
+			throw VideoCaptureException(string(msg));
+		}
+
+		// decoder wants more input
+		rc = (sync_mode) ? ReadStreamPacket(&pkt, video_stream) : ReadPacket(&pkt);
+		if (rc == AVERROR(EAGAIN)) continue;
+		if (rc == AVERROR_EOF){
+			avcodec_send_packet(dec_ctx, NULL);
+			continue;
+		}
+		if (rc < 0){
 			av_strerror(rc, msg, sizeof(msg));
 			throw VideoCaptureException(string(msg));
 		}
-		break;
+		if (pkt.stream_index == video_stream && !SkipPacket(pkt)){
+			if ((rc = avcodec_send_packet(dec_ctx, &pkt)) < 0 && rc != AVERROR_EOF){
+				av_packet_unref(&pkt);
+				av_strerror(rc, msg, sizeof(msg));
+				throw VideoCaptureException(string(msg));
+			}
+		}
+		av_packet_unref(&pkt);
+	}
+}
+
+int VideoCapture::ExtractFrames(const vector<int64_t> &timestamps, vector<AVFrame*> &frames){
+	if (dec_ctx == NULL)
+		throw VideoCaptureException("no video stream");
+	char msg[64];
+	int rc;
+	AVStream *st = fmt_ctx->streams[video_stream];
+	int64_t start_ts = (st->start_time != AV_NOPTS_VALUE) ? st->start_time : 0;
+	const double default_gop_secs = 10.0;
+	int64_t gop = av_rescale_q((int64_t)(default_gop_secs*AV_TIME_BASE), AV_TIME_BASE_Q, st->time_base);
+	int64_t last_key = AV_NOPTS_VALUE;
+
+	// timestamps jump, so no fps filter
+	use_fps_filter = false;
+	ResetVideoFilters();
+	// decoded frames come out of the filters, e.g. yadif, in their own time base
+	AVRational tb = (bypass_video_filters) ? st->time_base : av_buffersink_get_time_base(buffersink_ctx);
+
+	AVFrame *prev = av_frame_alloc();
+	AVFrame *cur = av_frame_alloc();
+	if (prev == NULL || cur == NULL){
+		av_frame_free(&prev);
+		av_frame_free(&cur);
+		throw VideoCaptureException("unable to allocate frames");
+	}
+	bool have_prev = false, eof = false;
+	int count = 0;
+	frames.assign(timestamps.size(), NULL);
+	try {
+		for (size_t i=0;i<timestamps.size();i++){
+			int64_t target = start_ts + av_rescale_q(timestamps[i], AV_TIME_BASE_Q, st->time_base);
+			int64_t frame_target = av_rescale_q(target, st->time_base, tb);
+			int64_t pos = (have_prev) ? av_rescale_q(prev->pts, tb, st->time_base) : start_ts;
+
+			// plan: seek when it skips more decoding than it costs
+			bool seek = false;
+			if (target > pos){
+				int64_t key = keyframe_before(st, target);
+				if (key != AV_NOPTS_VALUE)
+					seek = key > pos;
+				else
+					seek = target - pos > gop;
+			}
+			if (seek){
+				if ((rc = avformat_seek_file(fmt_ctx, video_stream, INT64_MIN, target, target, 0)) < 0){
+					av_strerror(rc, msg, sizeof(msg));
+					throw VideoCaptureException(string(msg));
+				}
+				avcodec_flush_buffers(dec_ctx);
+				ResetVideoFilters();
+				av_frame_unref(prev);
+				have_prev = false;
+				eof = false;
+			}
+
+			// decode forward to first frame at or after target
+			while (!eof && !(have_prev && prev->pts >= frame_target)){
+				if (DecodeVideoFrame(cur) < 0){
+					eof = true;
+					break;
+				}
+				if (cur->key_frame){
+					if (last_key != AV_NOPTS_VALUE && cur->pts > last_key)
+						gop = av_rescale_q(cur->pts - last_key, tb, st->time_base);
+					last_key = cur->pts;
+				}
+				bool past = cur->pts >= frame_target;
+				bool closer_prev = have_prev && past && (frame_target - prev->pts) < (cur->pts - frame_target);
+				if (closer_prev){
+					// keep prev as nearest; cur becomes prev for the next target
+					if ((frames[i] = av_frame_clone(prev)) == NULL)
+						throw VideoCaptureException("unable to clone frame");
+					count++;
+				}
+				av_frame_unref(prev);
+				av_frame_move_ref(prev, cur);
+				have_prev = true;
+				if (closer_prev) break;
+			}
+			if (frames[i] == NULL && have_prev){
+				if ((frames[i] = av_frame_clone(prev)) == NULL)
+					throw VideoCaptureException("unable to clone frame");
+				count++;
+			}
+		}
+	} catch (...){
+		av_frame_free(&prev);
+		av_frame_free(&cur);
+		throw;
 	}
+	av_frame_free(&prev);
+	av_frame_free(&cur);
+	return count;
+}
+
+AVFrame* VideoCapture::PullVideoFrame(){
+	AVFrame *frame = NULL;
+	PullVideoFrame(frame, -1);
 	return frame;
 }
 
+int VideoCapture::PullVideoFrame(AVFrame* &frame, int timeout_ms){
+	AVFrame *pooled = NULL;
+	frame = NULL;
+	int rc = PullPooledVideoFrame(pooled, timeout_ms);
+	if (rc < 0) return rc;
+	// caller owns the frame, so hand over the buffers in a new frame
+	if ((frame = av_frame_alloc()) == NULL){
+		ReleaseVideoFrame(pooled);
+		throw VideoCaptureException("unable to allocate frame");
+	}
+	av_frame_move_ref(frame, pooled);
+	ReleaseVideoFrame(pooled);
+	return 0;
+}
+
+int VideoCapture::PullPooledVideoFrame(AVFrame* &frame, int timeout_ms){
+	frame = NULL;
+	if (video_frames_queue == NULL) return AVERROR_EOF;
+	char msg[64];
+	uint64_t start = now_ns();
+	int rc = video_frames_queue->Recv(frame, timeout_ms);
+	add_elapsed(counters.video_wait_ns, start);
+	if (rc < 0 && rc != AVERROR(EAGAIN) && rc != AVERROR_EOF){
+		av_strerror(rc, msg, sizeof(msg));
+		throw VideoCaptureException(string(msg));
+	}
+	return rc;
+}
+
+void VideoCapture::ReleaseVideoFrame(AVFrame *frame){
+	if (video_frame_pool != NULL)
+		video_frame_pool->Release(frame);
+}
+
+int VideoCapture::PullPooledVideoFrames(AVFrame **out, int max, int timeout_ms){
+	if (video_frames_queue == NULL) return AVERROR_EOF;
+	char msg[64];
+	uint64_t start = now_ns();
+	int rc = video_frames_queue->RecvBatch(out, max, timeout_ms);
+	add_elapsed(counters.video_wait_ns, start);
+	if (rc < 0 && rc != AVERROR(EAGAIN) && rc != AVERROR_EOF){
+		av_strerror(rc, msg, sizeof(msg));
+		throw VideoCaptureException(string(msg));
+	}
+	return rc;
+}
+
+void VideoCapture::ReleaseVideoFrames(AVFrame **frames, int n){
+	if (video_frame_pool != NULL && n > 0)
+		video_frame_pool->Release(frames, n);
+}
+
+int VideoCapture::PullVideoFrames(AVFrame **out, int max, int timeout_ms){
+	int n = PullPooledVideoFrames(out, max, timeout_ms);
+	if (n <= 0) return n;
+	// caller owns the frames, so hand the buffers over in new frames
+	vector<AVFrame*> pooled(out, out + n);
+	for (int i=0;i<n;i++){
+		if ((out[i] = av_frame_alloc()) == NULL){
+			for (int j=0;j<i;j++)
+				av_frame_free(&out[j]);
+			ReleaseVideoFrames(pooled.data(), n);
+			throw VideoCaptureException("unable to allocate frame");
+		}
+		av_frame_move_ref(out[i], pooled[i]);
+	}
+	ReleaseVideoFrames(pooled.data(), n);
+	return n;
+}
+
+int VideoCapture::PullVideoFrame(VideoFrame &frame, int timeout_ms){
+	frame.Release();
+	AVFrame *pooled = NULL;
+	int rc = PullPooledVideoFrame(pooled, timeout_ms);
+	frame = VideoFrame(pooled, (rc == 0) ? video_frame_pool : NULL);
+	return rc;
+}
+
+int VideoCapture::PullFrameView(FrameView &view, unsigned plane_mask, int timeout_ms){
+	view.Release();
+	AVFrame *pooled = NULL;
+	int rc = PullPooledVideoFrame(pooled, timeout_ms);
+	if (rc < 0) return rc;
+	try {
+		view = FrameView(pooled, plane_mask);
+	} catch (std::bad_alloc &ex){
+		ReleaseVideoFrame(pooled);
+		throw VideoCaptureException("unable to reference frame buffers");
+	}
+	ReleaseVideoFrame(pooled);
+	return 0;
+}
+
+int VideoCapture::TryPullVideoFrame(AVFrame* &frame){
+	return PullVideoFrame(frame, 0);
+}
 
 AVFrame* VideoCapture::PullVideoKeyFrame(){
 	AVFrame *frame = NULL;
@@ -861,86 +2173,155 @@ AVFrame* VideoCapture::PullVideoKeyFrame(){
 	return frame;
 }
 
-int VideoCapture::PullAudioSamples(int16_t buf[], int buffer_length){
-	if (adec_ctx == NULL || flt_fmt) return -1;
-	int pos = 0;
-	int16_t *samples = circ_buf.s16samples;
-	bool again = true;
-	while (again){
-		while (audio_consumer_flag.test_and_set(memory_order_acquire));
-		unsigned long head = circ_buf.head.load(memory_order_acquire);
-		unsigned long tail = circ_buf.tail.load(memory_order_acquire);
-		unsigned long nelems = CIRC_CNT(head, tail, CircBufferSize);
-		if (nelems > 0){
-		    int limit = ((int)nelems < buffer_length) ? (int)nelems : buffer_length;
-			while (pos < limit){
-				buf[pos] = samples[tail];
-				tail = (tail) & (CircBufferSize - 1);
-				pos++;
-				tail++;
-			}
-			circ_buf.tail.store(tail, memory_order_release);
-		}
-		audio_consumer_flag.clear(memory_order_release);
-		if (pos >= buffer_length || stop_flag.load(memory_order_acquire)){
-			again = false;
-		}
+int VideoCapture::PullFrameHash(HashRecord &rec, int timeout_ms){
+	if (hash_queue == NULL) return AVERROR_EOF;
+	char msg[64];
+	int rc = hash_queue->Recv(rec, timeout_ms);
+	if (rc < 0 && rc != AVERROR(EAGAIN) && rc != AVERROR_EOF){
+		av_strerror(rc, msg, sizeof(msg));
+		throw VideoCaptureException(string(msg));
 	}
-	return pos;
+	return rc;
 }
 
-int VideoCapture::PullAudioSamples(float buf[], int buffer_length){
-	if (adec_ctx == NULL || !flt_fmt) return -1;
-	int pos = 0;
-	float *samples = circ_buf.fltsamples;
-	bool again = true;
-	while (again){
-		while (audio_consumer_flag.test_and_set(memory_order_acquire));;
-		unsigned long head = circ_buf.head.load(memory_order_acquire);
-		unsigned long tail = circ_buf.tail.load(memory_order_relaxed);
-		unsigned long nelems = CIRC_CNT(head, tail, CircBufferSize);
-		if ((int)nelems > 0){
-			int limit = ((int)nelems < buffer_length) ? (int)nelems : buffer_length;
-			while (pos < limit){
-				buf[pos] = samples[tail];
-				tail = (tail) & (CircBufferSize - 1);
-				pos++;
-				tail++;
-			}
-			circ_buf.tail.store(tail, memory_order_release);
-		}
-		audio_consumer_flag.clear(memory_order_release);
-		if (pos >= buffer_length || stop_flag.load(memory_order_acquire)){
-			again = false;
-		}
+int VideoCapture::PullAudioFingerprint(AudioFingerprint &fp, int timeout_ms){
+	if (fingerprint_queue == NULL) return AVERROR_EOF;
+	char msg[64];
+	int rc = fingerprint_queue->Recv(fp, timeout_ms);
+	if (rc < 0 && rc != AVERROR(EAGAIN) && rc != AVERROR_EOF){
+		av_strerror(rc, msg, sizeof(msg));
+		throw AudioCaptureException(string(msg));
 	}
-	return pos;
+	return rc;
+}
+
+int VideoCapture::PullAudioSamples(int16_t buf[], int buffer_length){
+	if (s16_buf == NULL) return -1;
+	uint64_t start = now_ns();
+	int n = (int)s16_buf->Read(buf, buffer_length);
+	add_elapsed(counters.audio_wait_ns, start);
+	return n;
+}
+
+int VideoCapture::PullAudioSamples(float buf[], int buffer_length){
+	if (flt_buf == NULL) return -1;
+	uint64_t start = now_ns();
+	int n = (int)flt_buf->Read(buf, buffer_length);
+	add_elapsed(counters.audio_wait_ns, start);
+	return n;
+}
+
+int VideoCapture::PeekAudio(SampleSpan<int16_t> &first, SampleSpan<int16_t> &second, int min_count){
+	if (s16_buf == NULL) return -1;
+	uint64_t start = now_ns();
+	int n = (int)s16_buf->Peek(first, second, (min_count > 0) ? min_count : 1);
+	add_elapsed(counters.audio_wait_ns, start);
+	return n;
+}
+
+int VideoCapture::PeekAudio(SampleSpan<float> &first, SampleSpan<float> &second, int min_count){
+	if (flt_buf == NULL) return -1;
+	uint64_t start = now_ns();
+	int n = (int)flt_buf->Peek(first, second, (min_count > 0) ? min_count : 1);
+	add_elapsed(counters.audio_wait_ns, start);
+	return n;
+}
+
+void VideoCapture::CommitAudio(int n){
+	if (n <= 0) return;
+	if (s16_buf != NULL)
+		s16_buf->Commit(n);
+	else if (flt_buf != NULL)
+		flt_buf->Commit(n);
 }
 
 AVSubtitle* VideoCapture::PullSubtitle(){
-	if (subtitle_queue == NULL) return NULL;
-	char msg[64];
 	AVSubtitle *sub = NULL;
-	while (true){
-		int rc = av_thread_message_queue_recv(subtitle_queue, &sub,
-											  AV_THREAD_MESSAGE_NONBLOCK);
-		if (AVERROR(rc) == EAGAIN) continue;
-		if (rc == AVERROR_EOF)break;
-		if (rc < 0) {
-			av_strerror(rc, msg, sizeof(msg));
-			throw VideoCaptureException(string(msg));
-		}
-		break;
-	}
+	PullSubtitle(sub, -1);
 	return sub;
 }
 
+int VideoCapture::PullSubtitle(AVSubtitle* &sub, int timeout_ms){
+	sub = NULL;
+	if (subtitle_queue == NULL) return AVERROR_EOF;
+	char msg[64];
+	uint64_t start = now_ns();
+	int rc = subtitle_queue->Recv(sub, timeout_ms);
+	add_elapsed(counters.subtitle_wait_ns, start);
+	if (rc < 0 && rc != AVERROR(EAGAIN) && rc != AVERROR_EOF){
+		av_strerror(rc, msg, sizeof(msg));
+		throw VideoCaptureException(string(msg));
+	}
+	return rc;
+}
+
+int VideoCapture::TryPullSubtitle(AVSubtitle* &sub){
+	return PullSubtitle(sub, 0);
+}
+
+int VideoCapture::PullSubtitles(AVSubtitle **out, int max, int timeout_ms){
+	if (subtitle_queue == NULL) return AVERROR_EOF;
+	char msg[64];
+	uint64_t start = now_ns();
+	int rc = subtitle_queue->RecvBatch(out, max, timeout_ms);
+	add_elapsed(counters.subtitle_wait_ns, start);
+	if (rc < 0 && rc != AVERROR(EAGAIN) && rc != AVERROR_EOF){
+		av_strerror(rc, msg, sizeof(msg));
+		throw VideoCaptureException(string(msg));
+	}
+	return rc;
+}
+
+CaptureStats VideoCapture::GetStats(){
+	const double ns = 1e-9;
+	CaptureStats stats;
+	stats.packets_read = counters.packets_read.load(memory_order_relaxed);
+	stats.bytes_read = counters.bytes_read.load(memory_order_relaxed);
+	stats.read_secs = ns*counters.read_ns.load(memory_order_relaxed);
+	stats.video_decode_secs = ns*counters.video_decode_ns.load(memory_order_relaxed);
+	stats.audio_decode_secs = ns*counters.audio_decode_ns.load(memory_order_relaxed);
+	stats.subtitle_decode_secs = ns*counters.subtitle_decode_ns.load(memory_order_relaxed);
+	stats.video_filter_secs = ns*counters.video_filter_ns.load(memory_order_relaxed);
+	stats.audio_filter_secs = ns*counters.audio_filter_ns.load(memory_order_relaxed);
+	stats.video_frames = counters.video_frames.load(memory_order_relaxed);
+	stats.video_frames_dropped = counters.video_frames_dropped.load(memory_order_relaxed);
+	stats.audio_samples = counters.audio_samples.load(memory_order_relaxed);
+	stats.subtitles = counters.subtitles.load(memory_order_relaxed);
+	stats.subtitles_dropped = counters.subtitles_dropped.load(memory_order_relaxed);
+	stats.video_wait_secs = ns*counters.video_wait_ns.load(memory_order_relaxed);
+	stats.audio_wait_secs = ns*counters.audio_wait_ns.load(memory_order_relaxed);
+	stats.subtitle_wait_secs = ns*counters.subtitle_wait_ns.load(memory_order_relaxed);
+	stats.video_pkt_queue_depth = counters.pkt_queue_depth[0].load(memory_order_relaxed);
+	stats.audio_pkt_queue_depth = counters.pkt_queue_depth[1].load(memory_order_relaxed);
+	stats.subtitle_pkt_queue_depth = counters.pkt_queue_depth[2].load(memory_order_relaxed);
+	if (video_frames_queue != NULL){
+		stats.video_queue_depth = video_frames_queue->Size();
+		stats.video_queue_capacity = video_frames_queue->Capacity();
+	}
+	if (subtitle_queue != NULL)
+		stats.subtitle_queue_depth = subtitle_queue->Size();
+	if (hash_queue != NULL)
+		stats.hash_queue_depth = hash_queue->Size();
+	if (fingerprint_queue != NULL)
+		stats.fingerprint_queue_depth = fingerprint_queue->Size();
+	if (s16_buf != NULL){
+		stats.audio_ring_fill = s16_buf->Count();
+		stats.audio_ring_size = s16_buf->Size();
+	} else if (flt_buf != NULL){
+		stats.audio_ring_fill = flt_buf->Count();
+		stats.audio_ring_size = flt_buf->Size();
+	}
+	return stats;
+}
+
 AVRational VideoCapture::GetVideoTimebase(){
 	AVRational result;
 	result.num = 0;
 	result.den = 0;
-	if (video_stream >= 0)
+	if (video_stream >= 0 && buffersink_ctx != NULL)
 		result = buffersink_ctx->inputs[0]->time_base;
+	else if (video_stream >= 0)
+		result = fmt_ctx->streams[video_stream]->time_base;
 	return result;
 }
 
@@ -954,15 +2335,17 @@ AVRational VideoCapture::GetAudioTimebase(){
 }
 
 AVRational VideoCapture::GetAvgFrameRate(){
-	if (video_stream >= 0)
-		return av_buffersink_get_frame_rate(buffersink_ctx);
-	return av_make_q(0,0);
+	if (video_stream < 0)
+		return av_make_q(0,0);
+	if (buffersink_ctx != NULL){
+		AVRational rate = av_buffersink_get_frame_rate(buffersink_ctx);
+		if (rate.num > 0) return rate;   // unset without an fps filter
+	}
+	return fmt_ctx->streams[video_stream]->avg_frame_rate;
 }
 
 double VideoCapture::GetAvgFrameRate_d(){
-	if (video_stream >= 0)
-		return av_q2d(av_buffersink_get_frame_rate(buffersink_ctx));
-	return 0;
+	return av_q2d(GetAvgFrameRate());
 }
 
 int VideoCapture::GetAudioSampleRate(){
@@ -981,21 +2364,119 @@ MetaData& VideoCapture::GetMetaData(){
 	return metadata;
 }
 
+int VideoCapture::GetVideoDecoderThreads(){
+	return (dec_ctx != NULL) ? dec_ctx->thread_count : 0;
+}
+
+int VideoCapture::GetAudioDecoderThreads(){
+	return (adec_ctx != NULL) ? adec_ctx->thread_count : 0;
+}
+
+void VideoCapture::SetCoreBudget(int cores){
+	core_budget.store(cores);
+}
+
+int VideoCapture::GetCoreBudget(){
+	int cores = core_budget.load();
+	return (cores > 0) ? cores : av_cpu_count();
+}
+
+/** PHTHREADS_AUTO takes an even share of the budget among open captures,
+ *  no more than is left of it and at least 1; a fixed count is taken as is
+ **/
+int VideoCapture::ReserveThreads(int threads){
+	if (threads != PHTHREADS_AUTO){
+		if (threads > 0) threads_reserved.fetch_add(threads);
+		return threads;
+	}
+	int budget = GetCoreBudget();
+	int n = nb_captures.load();
+	int share = (n > 1) ? budget/n : budget;
+	int reserved = threads_reserved.load();
+	do {
+		threads = min(share, budget - reserved);
+		if (threads < 1) threads = 1;
+	} while (!threads_reserved.compare_exchange_weak(reserved, reserved + threads));
+	return threads;
+}
+
+void VideoCapture::ReleaseThreads(int threads){
+	if (threads > 0) threads_reserved.fetch_sub(threads);
+}
+
+void VideoCapture::Stop(){
+	stop_requested.store(true);
+	if (video_frame_pool != NULL)
+		video_frame_pool->Close();
+	if (hash_queue != NULL)
+		hash_queue->SetErrSend(AVERROR_EXIT);
+	if (fingerprint_queue != NULL)
+		fingerprint_queue->SetErrSend(AVERROR_EXIT);
+	if (subtitle_queue != NULL)
+		subtitle_queue->SetErrSend(AVERROR_EXIT);
+	if (s16_buf != NULL)
+		s16_buf->Close();
+	if (flt_buf != NULL)
+		flt_buf->Close();
+}
+
 void VideoCapture::Close(){
-	if (adec_ctx != NULL){
-		delete[] circ_buf.fltsamples;
+	// fail a producer still waiting on the pool
+	if (video_frame_pool != NULL)
+		video_frame_pool->Close();
+	if (counted){
+		nb_captures--;
+		counted = false;
 	}
+	ReleaseThreads(decoder_threads);
+	decoder_threads = 0;
+	for (AVPacket *pkt : video_pending)
+		av_packet_free(&pkt);
+	for (AVPacket *pkt : audio_pending)
+		av_packet_free(&pkt);
+	video_pending.clear();
+	audio_pending.clear();
+	delete s16_buf;
+	delete flt_buf;
+	s16_buf = NULL;
+	flt_buf = NULL;
     avcodec_close(dec_ctx);
 	avcodec_close(adec_ctx);
 	avcodec_close(subdec_ctx);
     avformat_close_input(&fmt_ctx);
+	if (avio_ctx != NULL){   // custom io is not freed with the format context
+		av_freep(&avio_ctx->buffer);
+		avio_context_free(&avio_ctx);
+	}
     av_frame_free(&pframe_decoded);
 	av_frame_free(&pframe_filtered);
 	av_frame_free(&pframeAu);
 	av_frame_free(&pframeAufiltered);
     avfilter_graph_free(&filter_graph);
 	avfilter_graph_free(&afilter_graph);
-	av_thread_message_queue_free(&video_frames_queue);
-	av_thread_message_queue_free(&subtitle_queue);
+	if (video_frames_queue != NULL){
+		AVFrame *frame;
+		while (video_frames_queue->Recv(frame, 0) == 0)
+			video_frame_pool->Release(frame);
+		delete video_frames_queue;
+		video_frames_queue = NULL;
+	}
+	delete video_frame_pool;
+	video_frame_pool = NULL;
+	if (subtitle_queue != NULL){
+		AVSubtitle *sub;
+		while (subtitle_queue->Recv(sub, 0) == 0){
+			avsubtitle_free(sub);
+			free(sub);
+		}
+		delete subtitle_queue;
+		subtitle_queue = NULL;
+	}
+	delete hash_queue;
+	hash_queue = NULL;
+	delete fingerprint_queue;
+	fingerprint_queue = NULL;
+	delete fingerprinter;
+	fingerprinter = NULL;
 }
 
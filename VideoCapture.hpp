@@ -32,8 +32,20 @@ SOFTWARE.
 #include <cstring>
 #include <cstdint>
 #include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <functional>
 #include <stdexcept>
 #include <atomic>
+#include <exception>
+#include "MessageQueue.hpp"
+#include "CircBuffer.hpp"
+#include "FramePool.hpp"
+#include "FrameView.hpp"
+#include "InputSource.hpp"
+#include "PHash.hpp"
+#include "AudioFingerprint.hpp"
 
 extern "C" {
 #include <libavformat/avformat.h>
@@ -43,7 +55,6 @@ extern "C" {
 // this file does not exist on Linux
 #include <libavfilter/avfiltergraph.h>
 #endif
-#include <libavutil/threadmessage.h>
 #include <libavutil/opt.h>
 #include <libavutil/dict.h>
 #include <libavutil/mathematics.h>
@@ -59,10 +70,53 @@ using namespace std;
 #define PHCAPTURE_VIDEOSUBTITLE_FLAG 0x0005
 #define PHCAPTURE_AUDIOSUBTITLE_FLAG 0x0006
 #define PHCAPTURE_ALL_FLAG 0x0007
+/* mode flags, or'd with the stream flags above */
+#define PHCAPTURE_PIPELINE_FLAG 0x0010  /* demux and per-stream decode threads */
+#define PHCAPTURE_KEYFRAME_FLAG 0x0020  /* decode only video key frames */
+#define PHCAPTURE_HASH_FLAG 0x0040      /* perceptual hash of each video frame */
+#define PHCAPTURE_HASHONLY_FLAG 0x0080  /* hashes only, video frames are not queued */
+#define PHCAPTURE_AUDIOFP_FLAG 0x0100   /* fingerprints of the resampled audio */
+#define PHCAPTURE_AUDIOFPONLY_FLAG 0x0200  /* fingerprints only, samples are not buffered */
+#define PHCAPTURE_SYNC_FLAG 0x0400      /* NextVideoFrame()/NextAudioChunk() only; no queues, no Process() */
 
 #define PHAUDIO_S16_FMT 0x0000
 #define PHAUDIO_FLT_FMT 0x0001
 
+/* video output pixel format */
+#define PHPIXFMT_YUV444P 0x0000  /* planar yuv, full chroma */
+#define PHPIXFMT_GRAY8 0x0001    /* luma only, e.g. for hashing */
+#define PHPIXFMT_SOURCE 0x0002   /* decoder's format if yuv420p, yuv422p, yuv444p or gray */
+
+/* deinterlacing */
+#define PHDEINT_AUTO 0x0000      /* when the stream field order is interlaced */
+#define PHDEINT_OFF 0x0001
+#define PHDEINT_ON 0x0002        /* frames flagged interlaced, whatever the field order */
+
+/* video and subtitle queue policy when consumers fall behind
+ * PHQUEUE_BLOCK, the video default, is lossless: decoding waits while
+ * consumers hold every pool frame, so pull each captured stream, use a
+ * drop policy, or end Process() with Stop() */
+#define PHQUEUE_BLOCK 0x0000        /* decoding waits, nothing is lost */
+#define PHQUEUE_DROP_NEWEST 0x0001  /* new frames are dropped */
+#define PHQUEUE_DROP_OLDEST 0x0002  /* oldest queued frame makes room */
+#define PHQUEUE_DROP_NONKEY 0x0003  /* new non-key frames dropped, key frames wait */
+
+/* CountVideoPackets method */
+#define PHCOUNT_NONE 0x0000       /* no video stream */
+#define PHCOUNT_NB_FRAMES 0x0001  /* frame count in stream header */
+#define PHCOUNT_INDEX 0x0002      /* container index entries */
+#define PHCOUNT_DURATION 0x0003   /* duration x frame rate estimate */
+#define PHCOUNT_SCAN 0x0004       /* read every packet */
+
+/* decoder threading type */
+#define PHTHREAD_DEFAULT 0x0000  /* libavcodec default */
+#define PHTHREAD_FRAME 0x0001
+#define PHTHREAD_SLICE 0x0002
+
+/* decoder thread count */
+#define PHTHREADS_DEFAULT 0      /* libavcodec default */
+#define PHTHREADS_AUTO -1        /* share of the process core budget */
+
 
 namespace ph {
 
@@ -80,28 +134,85 @@ typedef struct Metadata {
 	string disc_str;
 } MetaData;
 
-typedef struct circ_buf{
-	union {
-		float *fltsamples;
-		int16_t *s16samples;
-	};
-	atomic_ulong head;
-	atomic_ulong tail;
-} CircBuffer;
+typedef struct capture_options {
+	int top_m = 0;            // crop margins, in exact pixels even for subsampled
+	                          // chroma, after deinterlacing
+	int bottom_m = 0;
+	int left_m = 0;
+	int right_m = 0;
+	int sr = 44100;           // audio sample rate
+	int width = -1;           // scale to width, keeping aspect ratio
+	int flag = PHCAPTURE_ALL_FLAG;
+	int flt_fmt = PHAUDIO_FLT_FMT;
+	int fps = 0;              // 0 for source frame rate
+	int pix_fmt = PHPIXFMT_YUV444P;    // video output format
+	int deinterlace = PHDEINT_AUTO;
+	int video_queue_policy = PHQUEUE_BLOCK;           // was drop newest before the frame pool
+	int subtitle_queue_policy = PHQUEUE_DROP_NEWEST;  // PHQUEUE_DROP_NONKEY waits like PHQUEUE_BLOCK
+	bool warn = false;
+
+	int video_threads = PHTHREADS_DEFAULT;    // decoder threads, or PHTHREADS_AUTO
+	int video_thread_type = PHTHREAD_DEFAULT; // PHTHREAD_FRAME and/or PHTHREAD_SLICE
+	int audio_threads = PHTHREADS_DEFAULT;
+	int audio_thread_type = PHTHREAD_DEFAULT;
+
+	/* > 1 (or PHTHREADS_AUTO) decodes a video-only capture of a file as that
+	 * many independent segments in parallel; needs the source frame rate */
+	int segment_threads = 0;
+} CaptureOptions;
+
+/** snapshot of pipeline counters, see VideoCapture::GetStats() **/
+typedef struct capture_stats {
+	uint64_t packets_read = 0;
+	uint64_t bytes_read = 0;
+	double read_secs = 0;               // in av_read_frame
+	double video_decode_secs = 0;       // in avcodec_send_packet/receive_frame
+	double audio_decode_secs = 0;
+	double subtitle_decode_secs = 0;
+	double video_filter_secs = 0;       // in filter graph source/sink calls
+	double audio_filter_secs = 0;
+	uint64_t video_frames = 0;          // frames queued
+	uint64_t video_frames_dropped = 0;  // by video_queue_policy
+	uint64_t audio_samples = 0;         // samples written to the ring
+	uint64_t subtitles = 0;
+	uint64_t subtitles_dropped = 0;     // by subtitle_queue_policy
+	int video_queue_depth = 0;
+	int video_queue_capacity = 0;
+	int subtitle_queue_depth = 0;
+	int hash_queue_depth = 0;
+	int fingerprint_queue_depth = 0;
+	int video_pkt_queue_depth = 0;      // pipelined mode
+	int audio_pkt_queue_depth = 0;
+	int subtitle_pkt_queue_depth = 0;
+	unsigned long audio_ring_fill = 0;  // samples
+	unsigned long audio_ring_size = 0;
+	double video_wait_secs = 0;         // consumers inside Pull* calls
+	double audio_wait_secs = 0;
+	double subtitle_wait_secs = 0;
+} CaptureStats;
 
 const int CircBufferSize = 0x0001 << 20;
+
+/* inline delivery on the decode thread, see VideoCapture::OnVideoFrame() */
+typedef function<void(const AVFrame *frame)> VideoFrameCallback;
+typedef function<void(const AVFrame *frame)> AudioSamplesCallback;
+typedef function<void(const AVSubtitle *sub)> SubtitleCallback;
+
+struct video_segment;
 	
 /* VideoCapture class */
 class VideoCapture {
 protected: 
 	AVFormatContext *fmt_ctx = NULL;
+	AVIOContext *avio_ctx = NULL;
 	AVCodecContext *dec_ctx = NULL;
 	AVFrame *pframe_decoded = NULL;
 	AVFrame *pframe_filtered = NULL;
 	AVFilterContext *buffersink_ctx = NULL;
 	AVFilterContext *buffersrc_ctx = NULL;
 	AVFilterGraph *filter_graph = NULL;
-	AVThreadMessageQueue *video_frames_queue = NULL;
+	MessageQueue<AVFrame*> *video_frames_queue = NULL;
+	FramePool *video_frame_pool = NULL;
 	
 	AVCodecContext *adec_ctx = NULL;
 	AVFrame *pframeAu = NULL;
@@ -110,16 +221,30 @@ protected:
 	AVFilterContext *abuffersrc_ctx = NULL;
 	AVFilterGraph *afilter_graph = NULL;
 
-	CircBuffer circ_buf;
+	CircBuffer<int16_t> *s16_buf = NULL;
+	CircBuffer<float> *flt_buf = NULL;
+	AudioFingerprinter *fingerprinter = NULL;
+	MessageQueue<AudioFingerprint> *fingerprint_queue = NULL;
+	vector<AudioFingerprint> fingerprints;
+	bool fingerprint_started = false;
 	
 	AVCodecContext *subdec_ctx = NULL;
-	AVThreadMessageQueue *subtitle_queue = NULL;
+	MessageQueue<AVSubtitle*> *subtitle_queue = NULL;
+	MessageQueue<HashRecord> *hash_queue = NULL;
+
+	/* packet queues feeding stream workers in pipelined mode */
+	MessageQueue<AVPacket*> *video_pkt_queue = NULL;
+	MessageQueue<AVPacket*> *audio_pkt_queue = NULL;
+	MessageQueue<AVPacket*> *subtitle_pkt_queue = NULL;
 	
-	atomic_flag audio_producer_flag = ATOMIC_FLAG_INIT;
-	atomic_flag audio_consumer_flag = ATOMIC_FLAG_INIT;
-	atomic_bool stop_flag;
 
 	const int QueueCapacity = 64;
+	const int PacketQueueCapacity = 128;
+	const int HashQueueCapacity = 1024;
+	const int FingerprintQueueCapacity = 1024;
+	int capture_flag = 0;
+	bool use_fps_filter = true;
+	bool bypass_video_filters = false;  // decoded frames need no transform
 	int video_stream = -1;
 	int audio_stream = -1;
 	int subtitle_stream = -1;
@@ -129,11 +254,73 @@ protected:
 	
 	atomic_flag stop = ATOMIC_FLAG_INIT;
 
+	VideoFrameCallback on_video_frame;
+	AudioSamplesCallback on_audio_samples;
+	SubtitleCallback on_subtitle;
+
+	/* one-shot wakeup from NotifyVideoReady(), run by the producer */
+	mutex ready_mtx;
+	function<void()> video_ready;
+	atomic<bool> has_video_ready{false};
+	atomic<bool> video_ended{false};
+	void WakeVideoReady();
+
+	/* packets read ahead for the other stream by NextVideoFrame()/NextAudioChunk() */
+	bool sync_mode = false;
+	deque<AVPacket*> video_pending;
+	deque<AVPacket*> audio_pending;
+
+	/* Process(start, end) window per stream (video, audio, subtitle), in stream time base */
+	bool use_range = false;
+	int64_t range_start[3] = { 0, 0, 0 };
+	int64_t range_end[3] = { AV_NOPTS_VALUE, AV_NOPTS_VALUE, AV_NOPTS_VALUE };
+	atomic<bool> range_done[3]{};      // stream passed range_end
+
 	MetaData metadata;
+	CaptureOptions options;
+	string filename;       // empty for InputSource captures
+
+	/* always-on counters, updated with relaxed atomics; times in ns */
+	struct {
+		atomic<uint64_t> packets_read{0};
+		atomic<uint64_t> bytes_read{0};
+		atomic<uint64_t> read_ns{0};
+		atomic<uint64_t> video_decode_ns{0};
+		atomic<uint64_t> audio_decode_ns{0};
+		atomic<uint64_t> subtitle_decode_ns{0};
+		atomic<uint64_t> video_filter_ns{0};
+		atomic<uint64_t> audio_filter_ns{0};
+		atomic<uint64_t> video_frames{0};
+		atomic<uint64_t> video_frames_dropped{0};
+		atomic<uint64_t> audio_samples{0};
+		atomic<uint64_t> subtitles{0};
+		atomic<uint64_t> subtitles_dropped{0};
+		atomic<int> pkt_queue_depth[3]{};    // video, audio, subtitle
+		atomic<uint64_t> video_wait_ns{0};
+		atomic<uint64_t> audio_wait_ns{0};
+		atomic<uint64_t> subtitle_wait_ns{0};
+	} counters;
+
+	static atomic_int core_budget;
+	static atomic_int nb_captures;
+	static atomic_int threads_reserved;   // of core_budget, by all captures
+	bool counted = false;
+	atomic_bool stop_requested{false};
+	bool budgeted = true;                 // false for segment contexts, see ProcessSegmented()
+	int decoder_threads = 0;              // reserved by this capture's decoders
+
+	/** segment context: no core budget reserved, not counted in nb_captures **/
+	VideoCapture(const string &filename, const CaptureOptions &opts, bool budgeted);
 
 	/** init functions **/
+	void Open(const string &filename, InputSource *source, const CaptureOptions &opts);
 	void RegisterInit(bool warn);
+	void DiscardUnusedStreams();
+	void SeekRange(int64_t start, int64_t end);
+	bool InRange(int id, int64_t pts, int64_t duration);
+	bool RangeDone();
 	void OpenFile(const string &file);
+	void OpenSource(InputSource *source);
 	void InitMetaData();
 	void InitVideoCodec();
 	void InitAudioCodec();
@@ -141,16 +328,40 @@ protected:
 	void InitVideoFilters(const int tm, const int bm, const int lm, const int rm, const int width, const int dst_fps);
 	void InitAudioFilters(const int sr, const int flt_fmt);
 	void InitMsgQueues();
+	void SetDecoderThreads(AVCodecContext *ctx, int threads, int thread_type);
+	static int ReserveThreads(int threads);
+	static void ReleaseThreads(int threads);
 
 	/** aux functions **/
+	void FlushVideo();
+	void FlushAudio();
 	void FlushFrames();
 	void PushVideoFrames();               
+	bool QueueVideoFrame(const HashRecord *rec = NULL);
 	void HandleVideoPacket(AVPacket &pkt);
 	void PushAudioFrames_flt();          
 	void PushAudioFrames_s16();
 	void PushAudioFrames();
+	void DeliverAudioSamples();
+	void FingerprintAudio(const AVFrame *frame);
 	void HandleAudioPacket(AVPacket &pkt);
+	void QueueSubtitle(AVSubtitle *sub);
 	void HandleSubtitlePacket(AVPacket &pkt); 
+	void SignalEndOfStream();
+	bool SkipPacket(const AVPacket &pkt);
+	void DispatchPacket(AVPacket &pkt);
+	void RunStreamWorker(MessageQueue<AVPacket*> *queue, exception_ptr &ex);
+	void ProcessPipelined(int64_t secs);
+	int SegmentThreads(int64_t secs);
+	void ProcessSegmented(int nb_threads);
+	void DecodeSegment(struct video_segment &seg, bool hash, bool keep_frames);
+	uint32_t CountVideoPacketsScan();
+	void ResetVideoFilters();
+
+	/** av_read_frame, counted in stats **/
+	int ReadPacket(AVPacket *pkt);
+	int ReadStreamPacket(AVPacket *pkt, int stream);
+	int DecodeVideoFrame(AVFrame *frame);
 	
 public:
 	VideoCapture();
@@ -162,7 +373,8 @@ public:
 	 * @param right_m  crop right margin
 	 * @param sr       convert to sr sample rate
 	 * @param width    convert to width while keeping aspect ratio
-	 * @param flag     stream capture flag
+	 * @param flag     stream capture flag, optionally or'd with PHCAPTURE_PIPELINE_FLAG
+	 *                 and PHCAPTURE_KEYFRAME_FLAG
 	 * @param flt_fmt  audio format flag (0 for s16 integer, 1 for float - mono)
 	 * @param fps      desired frame rate (0 for source framerate)
 	 * @param warn     log warning errors 
@@ -172,6 +384,19 @@ public:
 				 const int width=-1, 
 				 int flag = PHCAPTURE_ALL_FLAG,
 				 int flt_fmt = PHAUDIO_FLT_FMT, int fps = 0, bool warn = false);
+
+	/** ctor
+	 * @param filename name of video file
+	 * @param opts     capture options
+	 **/
+	VideoCapture(const string &filename, const CaptureOptions &opts);
+
+	/** ctor for media not in a file, e.g. MemorySource, MappedFileSource
+	 *  or CallbackSource
+	 * @param source  read through a custom AVIOContext; must outlive the capture
+	 * @param opts    capture options
+	 **/
+	VideoCapture(InputSource &source, const CaptureOptions &opts);
 	~VideoCapture();
 
 	/** return raw video packet
@@ -184,39 +409,216 @@ public:
 	int NextPacket(AVPacket &pkt);
 
 	/** count video frame packets
-	 *  returns file position to beginning of file when done
+	 *  uses the stream header count or container index when reliable,
+	 *  otherwise reads the file and returns position to the beginning
 	 *  @return  no. of frame video packets in file
 	 *  @throws VideoCaptureException
 	 **/
 	uint32_t CountVideoPackets();
 
+	/** count video frame packets, cheapest method first
+	 *  @param method         set to the PHCOUNT_* method that produced the count
+	 *  @param exact          set false when the count is an estimate
+	 *  @param allow_estimate accept duration x frame rate rather than read the file
+	 *  @return no. of video packets
+	 *  @throws VideoCaptureException
+	 **/
+	uint32_t CountVideoPackets(int &method, bool &exact, bool allow_estimate = true);
+
     /** process packets async **/
 	/* @param dur - duration (in seconds) to stream - 0 for continuous*/
 	/** returns at EOF                       **/
+	/** with PHCAPTURE_PIPELINE_FLAG, this thread only demuxes; each   **/
+	/** stream decodes and filters on its own thread fed by a bounded  **/
+	/** packet queue                                                    **/
+	/** with segment_threads, the file is split into ~2 sec slices at  **/
+	/** key frames, decoded by that many threads each with its own     **/
+	/** format and codec contexts, and frames are queued in pts order; **/
+	/** memory grows with 2 x segment_threads slices of frames         **/
 	void Process(int64_t secs = 0);
 
+	/** process the frames in [start, end) only
+	 *  Seeks to the key frame at or before start, decodes and drops the
+	 *  frames before start, and returns once every captured stream has
+	 *  passed end (video and audio decide; subtitles are too sparse).
+	 *  Audio is cut at decoded frame boundaries. Call once, in place of Process().
+	 *  @param start  from start of file, in AV_TIME_BASE units
+	 *  @param end    AV_NOPTS_VALUE or <= start for end of file
+	 *  @throws VideoCaptureException
+	 **/
+	void Process(int64_t start, int64_t end);
+
+	/** extract frames nearest to a list of times
+	 *  Decodes in the calling thread, seeking to the preceding key frame
+	 *  when a gap is longer than decoding forward would be (per the index,
+	 *  or observed gop length). Not to be mixed with Process() or Pull*.
+	 *  @param timestamps  sorted times from start of file, in AV_TIME_BASE units
+	 *  @param frames      set to a frame per timestamp, the last frame for times past
+	 *                     end of stream; caller frees with av_frame_free
+	 *  @return no. frames extracted
+	 *  @throws VideoCaptureException
+	 **/
+	int ExtractFrames(const vector<int64_t> &timestamps, vector<AVFrame*> &frames);
+
+	/** next video frame, decoded and filtered in the calling thread
+	 *  Reads just enough packets for one output frame. Audio packets met on
+	 *  the way are held for NextAudioChunk(), so with both streams captured
+	 *  call both. Not to be mixed with Process() or Pull*; see PHCAPTURE_SYNC_FLAG.
+	 *  @param frame  allocated frame, set to the next frame; caller unrefs it
+	 *  @return 0 on success, AVERROR_EOF at end of stream
+	 *  @throws VideoCaptureException
+	 **/
+	int NextVideoFrame(AVFrame *frame);
+
+	/** next chunk of resampled mono audio, decoded in the calling thread
+	 *  frame->data[0] holds frame->nb_samples samples, float or s16 as
+	 *  the flt_fmt option; video packets are held for NextVideoFrame().
+	 *  @param frame  allocated frame, set to the next chunk; caller unrefs it
+	 *  @return 0 on success, AVERROR_EOF at end of stream
+	 *  @throws AudioCaptureException
+	 **/
+	int NextAudioChunk(AVFrame *frame);
+
+	/** deliver filtered video frames to cb instead of the frame queue
+	 *  cb runs inline on the decode thread (Process(), or its video worker
+	 *  in pipelined mode) as each frame comes out of the filter graph.
+	 *  The frame is borrowed for the call; av_frame_ref() it to keep it.
+	 *  Exceptions thrown by cb leave Process(). Set before Process().
+	 **/
+	void OnVideoFrame(VideoFrameCallback cb);
+
+	/** deliver resampled mono audio to cb instead of the sample ring
+	 *  frame->data[0] holds frame->nb_samples samples, float or s16 as
+	 *  the flt_fmt option; borrowed, as with OnVideoFrame().
+	 *  Frees the sample ring, so PullAudioSamples() and PeekAudio() return -1.
+	 **/
+	void OnAudioSamples(AudioSamplesCallback cb);
+
+	/** deliver subtitles to cb instead of the subtitle queue; borrowed **/
+	void OnSubtitle(SubtitleCallback cb);
+
 	/** pull frames from message queues**/
 	/** use in another thread to successively retrieve video frames  */
-	/** returns null at end of stream */
+	/** blocks until a frame is ready; returns null at end of stream */
+	/** legacy: allocates an AVFrame per call; prefer PullVideoFrame(VideoFrame&) */
 	AVFrame* PullVideoFrame();
 
+	/** pull frame, waiting at most timeout_ms milliseconds **/
+	/** legacy: allocates an AVFrame per call; prefer PullVideoFrame(VideoFrame&) **/
+	/** @param frame set to next frame on success **/
+	/** @param timeout_ms  neg. value waits indefinitely, 0 returns immediately **/
+	/** @return 0 on success, AVERROR(EAGAIN) on timeout, AVERROR_EOF at end of stream **/
+	int PullVideoFrame(AVFrame* &frame, int timeout_ms);
+
+	/** pull frame if one is ready, without waiting **/
+	/** legacy: allocates; PullVideoFrame(VideoFrame&, 0) does the same from the pool **/
+	/** @return 0 on success, AVERROR(EAGAIN) if none ready, AVERROR_EOF at end of stream **/
+	int TryPullVideoFrame(AVFrame* &frame);
+
+	/** pull frame owned by the capture's frame pool, without copying **/
+	/** return it with ReleaseVideoFrame() - never av_frame_free() **/
+	/** the producer waits while all pool frames are held by consumers **/
+	/** @return 0 on success, AVERROR(EAGAIN) on timeout, AVERROR_EOF at end of stream **/
+	int PullPooledVideoFrame(AVFrame* &frame, int timeout_ms = -1);
+
+	/** return frame from PullPooledVideoFrame() to the pool **/
+	void ReleaseVideoFrame(AVFrame *frame);
+
+	/** pull up to max ready frames under one queue lock
+	 *  waits, up to timeout_ms, for the first frame only
+	 *  @param out  set to pool frames; return with ReleaseVideoFrames()
+	 *  @return no. frames, AVERROR(EAGAIN) on timeout, AVERROR_EOF at end of stream
+	 **/
+	int PullPooledVideoFrames(AVFrame **out, int max, int timeout_ms = -1);
+
+	/** return n frames from PullPooledVideoFrames() to the pool at once **/
+	void ReleaseVideoFrames(AVFrame **frames, int n);
+
+	/** as PullPooledVideoFrames(), but the caller owns the frames (av_frame_free) **/
+	int PullVideoFrames(AVFrame **out, int max, int timeout_ms = -1);
+
+	/** have fn called once a video frame is queued or the stream ends
+	 *  fn runs on the producer thread and must not block; for event loops
+	 *  and the coroutine awaiters in CaptureAsync.hpp. One waiter at a time.
+	 *  @return false, without keeping fn, when a frame or the end is already there
+	 **/
+	bool NotifyVideoReady(function<void()> fn);
+
+	/** pull pooled frame wrapped in a handle that releases it when destroyed **/
+	/** the preferred way to pull frames: no allocation or copy per frame **/
+	/** frame's previous frame goes back to the pool first **/
+	/** @return 0 on success, AVERROR(EAGAIN) on timeout, AVERROR_EOF at end of stream **/
+	int PullVideoFrame(VideoFrame &frame, int timeout_ms = -1);
+
+	/** pull a view on some planes of the next frame, without copying **/
+	/** the pooled frame goes straight back to the pool and planes not in **/
+	/** plane_mask are released; see FrameView for the lifetime contract **/
+	/** @param plane_mask  PHPLANE_* flags, e.g. PHPLANE_Y for luma only **/
+	/** @return 0 on success, AVERROR(EAGAIN) on timeout, AVERROR_EOF at end of stream **/
+	int PullFrameView(FrameView &view, unsigned plane_mask = PHPLANE_ALL, int timeout_ms = -1);
+
 	/** pull key frames from message queues **/
 	/** use in anothe rthread to successivly retrieve video key frames */
 	/** return null at end of stream **/
+	/** capture with PHCAPTURE_KEYFRAME_FLAG so the other frames are never decoded **/
+	/** legacy: allocates; with PHCAPTURE_KEYFRAME_FLAG PullVideoFrame(VideoFrame&) **/
+	/** returns only key frames, from the pool **/
 	AVFrame* PullVideoKeyFrame();
 
+	/** pull perceptual hashes of the filtered video frames' luma plane **/
+	/** capture with PHCAPTURE_HASH_FLAG, or PHCAPTURE_HASHONLY_FLAG to skip the frames **/
+	/** the producer waits while the hash queue is full **/
+	/** @param rec  set to hashes and pts of the next frame **/
+	/** @return 0 on success, AVERROR(EAGAIN) on timeout, AVERROR_EOF at end of stream **/
+	int PullFrameHash(HashRecord &rec, int timeout_ms = -1);
+
+	/** pull fingerprints of the resampled mono audio, in order **/
+	/** capture with PHCAPTURE_AUDIOFP_FLAG, or PHCAPTURE_AUDIOFPONLY_FLAG to skip the samples **/
+	/** the producer waits while the fingerprint queue is full **/
+	/** @param fp  pts is in 1/GetAudioSampleRate() units **/
+	/** @return 0 on success, AVERROR(EAGAIN) on timeout, AVERROR_EOF at end of stream **/
+	int PullAudioFingerprint(AudioFingerprint &fp, int timeout_ms = -1);
+
 	/** pull audio samples from circular buffer **/
 	/** use in separate thread to retrieve samples **/
-	/** returns 0 at end of stream, -1 for no samples available  **/
+	/** blocks until buffer_length samples arrive or the stream ends **/
+	/** returns no. samples read, 0 at end of stream, -1 if the capture has no ring of that format **/
 	int PullAudioSamples(int16_t buf[], int buffer_length);
 	int PullAudioSamples(float buf[], int buffer_length);
 
+	/** audio samples in place in the circular buffer, without copying
+	 *  waits for min_count samples or end of stream; first and second
+	 *  split at the wrap point. Release them with CommitAudio().
+	 *  @return no. samples in the spans, 0 at end of stream, -1 if the
+	 *          capture has no audio of that format
+	 **/
+	int PeekAudio(SampleSpan<int16_t> &first, SampleSpan<int16_t> &second, int min_count = 1);
+	int PeekAudio(SampleSpan<float> &first, SampleSpan<float> &second, int min_count = 1);
+
+	/** hand the first n peeked samples back to the decoder; n is clamped **/
+	/** to the samples in the ring                                       **/
+	void CommitAudio(int n);
+
 
 	/** pull subtitles from message queue **/
 	/** use in separate thread  **/
-	/** returns null at end of stream **/
+	/** blocks until a subtitle is ready; returns null at end of stream **/
+	/** release with avsubtitle_free() and free() **/
 	AVSubtitle* PullSubtitle();
 
+	/** pull subtitle, waiting at most timeout_ms milliseconds **/
+	/** @return 0 on success, AVERROR(EAGAIN) on timeout, AVERROR_EOF at end of stream **/
+	int PullSubtitle(AVSubtitle* &sub, int timeout_ms);
+
+	/** pull subtitle if one is ready, without waiting **/
+	int TryPullSubtitle(AVSubtitle* &sub);
+
+	/** pull up to max ready subtitles under one queue lock; each is
+	 *  released with avsubtitle_free() and free()
+	 *  @return no. subtitles, AVERROR(EAGAIN) on timeout, AVERROR_EOF at end of stream
+	 **/
+	int PullSubtitles(AVSubtitle **out, int max, int timeout_ms = -1);
+
 	/** get time base for format **/
 	/** AVRational.num **/
 	/** AVRAtional.den **/
@@ -229,6 +631,27 @@ public:
 	int GetNumberPrograms();
 	MetaData& GetMetaData();
 
+	/** counters and timings of the capture so far, plus current queue depths **/
+	/** cheap enough to poll from a monitoring thread while Process() runs, **/
+	/** from construction until Close() **/
+	CaptureStats GetStats();
+
+	/** no. threads the opened video/audio decoder is using **/
+	int GetVideoDecoderThreads();
+	int GetAudioDecoderThreads();
+
+	/** cores shared by PHTHREADS_AUTO decoders of all captures in the process **/
+	/** default is the number of cpus; fixed thread counts, segment threads  **/
+	/** and pipelined workers also take from it until Close() / Process() end **/
+	static void SetCoreBudget(int cores);
+	static int GetCoreBudget();
+
+	/** have Process() return early, e.g. when consumers stop pulling
+	 *  Safe from any thread; wakes a producer waiting on a full frame pool
+	 *  or queue, and ends the streams for consumers.
+	 **/
+	void Stop();
+
 	void Close();
 };
 
@@ -0,0 +1,115 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+/* builds the C++20 interface of CaptureAsync.hpp; compiled with -std=c++20 */
+
+#include <cstdlib>
+#include <cerrno>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <future>
+#include <exception>
+#include <sys/stat.h>
+#include "VideoCapture.hpp"
+#include "CaptureAsync.hpp"
+#include "TestFixture.hpp"
+#include "TestCapture.hpp"
+
+using namespace std;
+
+#if !defined(__cpp_impl_coroutine)
+#error "testasync needs coroutine support"
+#endif
+
+/* starts eagerly, runs to completion on whichever thread resumes it */
+struct Task {
+	struct promise_type {
+		Task get_return_object(){ return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void(){}
+		void unhandled_exception(){ std::terminate(); }
+	};
+};
+
+/* pts of each frame, awaited without blocking a thread */
+static Task await_frames(ph::VideoCapture &vc, vector<int64_t> &pts, promise<void> &done){
+	while (ph::VideoFrame frame = co_await ph::NextFrame(vc))
+		pts.push_back(frame->pts);
+	done.set_value();
+}
+
+int main(int argc, char **argv){
+	string dir = (argc > 1) ? argv[1] : "testcapture-fixtures";
+	av_log_set_level(AV_LOG_ERROR);
+	if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST){
+		cout << "unable to create " << dir << endl;
+		return 1;
+	}
+	FixtureSpec spec = { "mpeg4", AV_CODEC_ID_MPEG4, 320, 240, false };
+	string path = dir + "/async_" + fixture_name(spec) + ".mkv";
+	if (access(path.c_str(), R_OK) != 0 && !make_fixture(spec, path)){
+		cout << "unable to generate fixture" << endl;
+		return 1;
+	}
+
+	int failed = 0;
+	try {
+		vector<int64_t> serial = serial_pts(path);
+
+		// FrameAwaiter: resumed on the Process() thread as frames are queued
+		{
+			ph::VideoCapture vc(path, video_options());
+			vector<int64_t> pts;
+			promise<void> done;
+			future<void> finished = done.get_future();
+			await_frames(vc, pts, done);
+			thread producer([&]{ vc.Process(); });
+			finished.wait();
+			producer.join();
+			if (!same_pts("NextFrame", serial, pts)) failed++;
+		}
+
+		// Generator: decoded on demand in this thread
+		{
+			ph::CaptureOptions opts = video_options();
+			opts.flag |= PHCAPTURE_SYNC_FLAG;
+			ph::VideoCapture vc(path, opts);
+			vector<int64_t> pts;
+			for (AVFrame *frame : ph::VideoFrames(vc))
+				pts.push_back(frame->pts);
+			if (!same_pts("VideoFrames", serial, pts)) failed++;
+		}
+	} catch (exception &ex){
+		cout << "error: " << ex.what() << endl;
+		failed++;
+	}
+
+	cout << ((failed) ? "FAILED" : "all ok") << endl;
+	return (failed) ? 1 : 0;
+}
@@ -0,0 +1,845 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather 
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#include <cstdlib>
+#include <cerrno>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <exception>
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <atomic>
+#include <sys/stat.h>
+#include "VideoCapture.hpp"
+#include "TestFixture.hpp"
+#include "TestCapture.hpp"
+
+using namespace std;
+
+/* long enough for several gops and segments */
+const double TestSecs = 6.0;
+
+/* what the tests compare of a pulled frame */
+typedef struct frame_info {
+	int64_t pts;
+	bool key_frame;
+	uint64_t luma;     // checksum of the luma plane
+	uint64_t phash;    // of the luma plane
+	uint64_t bmhash;
+	int width;
+	int height;
+	int format;
+} FrameInfo;
+
+/* fnv-1a over the rows of a plane, without the padding */
+static uint64_t plane_sum(const uint8_t *data, int linesize, int width, int height){
+	uint64_t sum = 14695981039346656037ULL;
+	for (int y=0;y<height;y++){
+		for (int x=0;x<width;x++)
+			sum = (sum ^ data[y*linesize + x])*1099511628211ULL;
+	}
+	return sum;
+}
+
+static FrameInfo frame_info(const AVFrame *frame){
+	FrameInfo info;
+	info.pts = frame->pts;
+	info.key_frame = frame->key_frame != 0;
+	info.luma = plane_sum(frame->data[0], frame->linesize[0], frame->width, frame->height);
+	info.phash = ph::PHash(frame->data[0], frame->linesize[0], frame->width, frame->height);
+	info.bmhash = ph::BlockMeanHash(frame->data[0], frame->linesize[0], frame->width, frame->height);
+	info.width = frame->width;
+	info.height = frame->height;
+	info.format = frame->format;
+	return info;
+}
+
+/* as pulled_pts(), with the pixels */
+static vector<FrameInfo> pulled_frames(ph::VideoCapture &vc, function<void()> run){
+	vector<FrameInfo> frames;
+	exception_ptr ex;
+	thread producer([&]{
+			try {
+				run();
+			} catch (...){
+				ex = current_exception();
+			}
+		});
+	ph::VideoFrame frame;
+	while (vc.PullVideoFrame(frame) == 0)
+		frames.push_back(frame_info(frame.get()));
+	frame.Release();
+	producer.join();
+	if (ex) rethrow_exception(ex);
+	return frames;
+}
+
+/* Process() on another thread while pull() empties the queues here */
+static void process_pulling(ph::VideoCapture &vc, function<void()> pull){
+	exception_ptr ex;
+	thread producer([&]{
+			try {
+				vc.Process();
+			} catch (...){
+				ex = current_exception();
+			}
+		});
+	pull();
+	producer.join();
+	if (ex) rethrow_exception(ex);
+}
+
+static vector<FrameInfo> captured_frames(const string &path, const ph::CaptureOptions &opts = video_options()){
+	ph::VideoCapture vc(path, opts);
+	return pulled_frames(vc, [&]{ vc.Process(); });
+}
+
+static bool same_frames(const char *name, const vector<FrameInfo> &expected, const vector<FrameInfo> &got){
+	size_t n = (expected.size() < got.size()) ? expected.size() : got.size();
+	for (size_t i=0;i<n;i++){
+		if (expected[i].pts != got[i].pts || expected[i].luma != got[i].luma){
+			cout << name << ": FAIL frame " << i << " pts " << got[i].pts
+				 << ((expected[i].luma != got[i].luma) ? ", other pixels" : "")
+				 << ", expected pts " << expected[i].pts << endl;
+			return false;
+		}
+	}
+	if (expected.size() != got.size()){
+		cout << name << ": FAIL " << got.size() << " frames, expected " << expected.size() << endl;
+		return false;
+	}
+	cout << name << ": ok, " << got.size() << " frames" << endl;
+	return true;
+}
+
+/* Process(start, end) keeps exactly the frames of the serial run in [start, end) */
+static bool test_range(const string &path, const vector<int64_t> &serial){
+	// between frames and mid gop, so the seek lands before start
+	const int64_t start = 1310000, end = 4710000;
+	ph::VideoCapture vc(path, video_options());
+	AVRational tb = vc.GetVideoTimebase();
+	int64_t start_pts = av_rescale_q(start, AV_TIME_BASE_Q, tb);
+	int64_t end_pts = av_rescale_q(end, AV_TIME_BASE_Q, tb);
+	vector<int64_t> expected;
+	for (int64_t pts : serial){
+		if (pts >= start_pts && pts < end_pts)
+			expected.push_back(pts);
+	}
+	vector<int64_t> ranged = pulled_pts(vc, [&]{ vc.Process(start, end); });
+	return same_pts("range", expected, ranged);
+}
+
+/* segmented decoding neither drops nor repeats frames at segment boundaries */
+static bool test_segmented(const string &path, const vector<int64_t> &serial){
+	ph::CaptureOptions opts = video_options();
+	opts.segment_threads = 4;
+	ph::VideoCapture vc(path, opts);
+	vector<int64_t> segmented = pulled_pts(vc, [&]{ vc.Process(); });
+	return same_pts("segmented", serial, segmented);
+}
+
+/* resampled audio samples of a serial Process() run */
+static long serial_samples(const string &path){
+	ph::CaptureOptions opts;
+	opts.flag = PHCAPTURE_AUDIO_FLAG;
+	ph::VideoCapture vc(path, opts);
+	exception_ptr ex;
+	thread producer([&]{
+			try {
+				vc.Process();
+			} catch (...){
+				ex = current_exception();
+			}
+		});
+	float buf[1024];
+	long total = 0;
+	int n;
+	while ((n = vc.PullAudioSamples(buf, 1024)) > 0)
+		total += n;
+	producer.join();
+	if (ex) rethrow_exception(ex);
+	return total;
+}
+
+static bool same_samples(const char *name, long expected, long got){
+	if (got != expected){
+		cout << name << ": FAIL " << got << " samples, expected " << expected << endl;
+		return false;
+	}
+	cout << name << ": ok, " << got << " samples" << endl;
+	return true;
+}
+
+/* NextVideoFrame()/NextAudioChunk(), called in turn, give the frames and
+ * samples of the serial runs */
+static bool test_sync(const string &path, const vector<int64_t> &serial){
+	ph::CaptureOptions opts;
+	opts.flag = PHCAPTURE_VIDEOAUDIO_FLAG | PHCAPTURE_SYNC_FLAG;
+	ph::VideoCapture vc(path, opts);
+	AVFrame *frame = av_frame_alloc();
+	assert(frame != NULL);
+	vector<int64_t> pts;
+	long samples = 0;
+	bool video_eof = false, audio_eof = false;
+	while (!video_eof || !audio_eof){
+		if (!video_eof){
+			if (vc.NextVideoFrame(frame) == 0){
+				pts.push_back(frame->pts);
+				av_frame_unref(frame);
+			} else {
+				video_eof = true;
+			}
+		}
+		if (!audio_eof){
+			if (vc.NextAudioChunk(frame) == 0){
+				samples += frame->nb_samples;
+				av_frame_unref(frame);
+			} else {
+				audio_eof = true;
+			}
+		}
+	}
+	av_frame_free(&frame);
+
+	ph::CaptureStats stats = vc.GetStats();
+	if (stats.video_frames != pts.size() || stats.audio_samples != (uint64_t)samples){
+		cout << "sync stats: FAIL " << stats.video_frames << " frames, "
+			 << stats.audio_samples << " samples counted" << endl;
+		return false;
+	}
+	bool ok = same_pts("sync video", serial, pts);
+	return same_samples("sync audio", serial_samples(path), samples) && ok;
+}
+
+/* pipelined Process() queues the frames and samples of the serial runs */
+static bool test_pipelined(const string &path, const vector<int64_t> &serial){
+	ph::CaptureOptions opts;
+	opts.flag = PHCAPTURE_VIDEOAUDIO_FLAG | PHCAPTURE_PIPELINE_FLAG;
+	ph::VideoCapture vc(path, opts);
+	vector<int64_t> pts = pulled_pts(vc, [&]{ vc.Process(); });
+	// the fixture's audio fits in the ring, so it is drained after the run
+	float buf[1024];
+	long samples = 0;
+	int n;
+	while ((n = vc.PullAudioSamples(buf, 1024)) > 0)
+		samples += n;
+	bool ok = same_pts("pipelined video", serial, pts);
+	return same_samples("pipelined audio", serial_samples(path), samples) && ok;
+}
+
+/* batched pulls, pooled or owned, keep every frame in order */
+static bool test_batched(const string &path, const vector<int64_t> &serial){
+	const int BatchSize = 8;
+	AVFrame *frames[BatchSize];
+	bool ok = true;
+	for (int pooled=0;pooled<2;pooled++){
+		ph::VideoCapture vc(path, video_options());
+		vector<int64_t> pts;
+		exception_ptr ex;
+		thread producer([&]{
+				try {
+					vc.Process();
+				} catch (...){
+					ex = current_exception();
+				}
+			});
+		int n;
+		while ((n = (pooled) ? vc.PullPooledVideoFrames(frames, BatchSize)
+				: vc.PullVideoFrames(frames, BatchSize)) > 0){
+			assert(n <= BatchSize);
+			for (int i=0;i<n;i++)
+				pts.push_back(frames[i]->pts);
+			if (pooled){
+				vc.ReleaseVideoFrames(frames, n);
+			} else {
+				for (int i=0;i<n;i++)
+					av_frame_free(&frames[i]);
+			}
+		}
+		producer.join();
+		if (ex) rethrow_exception(ex);
+		ok = same_pts((pooled) ? "batched pooled" : "batched", serial, pts) && ok;
+	}
+	return ok;
+}
+
+/* PHCAPTURE_KEYFRAME_FLAG queues the key frames of the serial run and nothing else */
+static bool test_keyframe(const string &path, const vector<FrameInfo> &frames){
+	vector<FrameInfo> expected;
+	for (const FrameInfo &f : frames){
+		if (f.key_frame) expected.push_back(f);
+	}
+	ph::CaptureOptions opts = video_options();
+	opts.flag |= PHCAPTURE_KEYFRAME_FLAG;
+	ph::VideoCapture vc(path, opts);
+	vector<FrameInfo> keys = pulled_frames(vc, [&]{ vc.Process(); });
+	for (const FrameInfo &f : keys){
+		if (!f.key_frame){
+			cout << "keyframe: FAIL non-key frame, pts " << f.pts << endl;
+			return false;
+		}
+	}
+	return same_frames("keyframe", expected, keys);
+}
+
+/* ExtractFrames() gives the serial frame nearest each time, seeking or decoding on */
+static bool test_extract(const string &path, const vector<FrameInfo> &frames){
+	// between frames, so there are no ties: a short gap, two times on one
+	// frame, gaps over a gop, and a time past the end for the last frame
+	const int64_t times[] = { 525000, 1205000, 1215000, 3995000, 5965000, 9000000 };
+	vector<int64_t> timestamps(times, times + sizeof(times)/sizeof(times[0]));
+	ph::VideoCapture vc(path, video_options());
+	AVRational tb = vc.GetVideoTimebase();
+	vector<FrameInfo> expected;
+	for (int64_t t : timestamps){
+		int64_t target = frames.front().pts + av_rescale_q(t, AV_TIME_BASE_Q, tb);
+		size_t nearest = 0;
+		for (size_t i=1;i<frames.size();i++){
+			if (llabs(frames[i].pts - target) < llabs(frames[nearest].pts - target))
+				nearest = i;
+		}
+		expected.push_back(frames[nearest]);
+	}
+
+	vector<AVFrame*> extracted;
+	int n = vc.ExtractFrames(timestamps, extracted);
+	vector<FrameInfo> got;
+	for (AVFrame *&frame : extracted){
+		if (frame != NULL) got.push_back(frame_info(frame));
+		av_frame_free(&frame);
+	}
+	if (n != (int)timestamps.size()){
+		cout << "extract: FAIL " << n << " frames extracted, expected " << timestamps.size() << endl;
+		return false;
+	}
+	return same_frames("extract", expected, got);
+}
+
+/* memory, mapped file and callback sources give the frames of the file */
+static bool test_sources(const string &path, const vector<FrameInfo> &frames){
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (fp == NULL){
+		cout << "sources: FAIL unable to open " << path << endl;
+		return false;
+	}
+	vector<uint8_t> data;
+	uint8_t chunk[65536];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+		data.insert(data.end(), chunk, chunk + n);
+
+	bool ok = true;
+	{
+		ph::MemorySource source(data.data(), data.size());
+		ph::VideoCapture vc(source, video_options());
+		ok = same_frames("memory source", frames, pulled_frames(vc, [&]{ vc.Process(); })) && ok;
+	}
+	{
+		ph::MappedFileSource source(path);
+		ph::VideoCapture vc(source, video_options());
+		ok = same_frames("mapped source", frames, pulled_frames(vc, [&]{ vc.Process(); })) && ok;
+	}
+	{
+		// no seek function, as for a pipe
+		rewind(fp);
+		ph::CallbackSource source([&](uint8_t *buf, int size){
+				size_t nread = fread(buf, 1, size, fp);
+				return (nread > 0) ? (int)nread : (ferror(fp)) ? AVERROR(EIO) : 0;
+			});
+		ph::VideoCapture vc(source, video_options());
+		ok = same_frames("callback source", frames, pulled_frames(vc, [&]{ vc.Process(); })) && ok;
+	}
+	fclose(fp);
+	return ok;
+}
+
+/* PHCAPTURE_HASHONLY_FLAG queues the hashes of the serial frames' luma, and no frames */
+static bool test_hash(const string &path, const vector<FrameInfo> &frames){
+	ph::CaptureOptions opts = video_options();
+	opts.flag |= PHCAPTURE_HASHONLY_FLAG;
+	ph::VideoCapture vc(path, opts);
+	vector<ph::HashRecord> hashes;
+	int frame_rc = 0;
+	process_pulling(vc, [&]{
+			ph::HashRecord rec;
+			while (vc.PullFrameHash(rec) == 0)
+				hashes.push_back(rec);
+			ph::VideoFrame frame;
+			frame_rc = vc.PullVideoFrame(frame, 0);
+		});
+	if (frame_rc != AVERROR_EOF){
+		cout << "hash: FAIL frames queued in hash only mode" << endl;
+		return false;
+	}
+	// hash only output is gray8, the same luma as the serial yuv444p frames
+	size_t n = (frames.size() < hashes.size()) ? frames.size() : hashes.size();
+	for (size_t i=0;i<n;i++){
+		if (hashes[i].pts != frames[i].pts || hashes[i].phash != frames[i].phash
+			|| hashes[i].bmhash != frames[i].bmhash){
+			cout << "hash: FAIL frame " << i << " pts " << hashes[i].pts << ", expected "
+				 << frames[i].pts << " with the same hashes" << endl;
+			return false;
+		}
+	}
+	if (hashes.size() != frames.size()){
+		cout << "hash: FAIL " << hashes.size() << " hashes, expected " << frames.size() << endl;
+		return false;
+	}
+	cout << "hash: ok, " << hashes.size() << " hashes" << endl;
+	return true;
+}
+
+/* PHCAPTURE_AUDIOFPONLY_FLAG queues the fingerprints of the serial samples, and no samples */
+static bool test_fingerprint(const string &path){
+	ph::CaptureOptions opts;
+	opts.flag = PHCAPTURE_AUDIO_FLAG;
+	vector<ph::AudioFingerprint> expected;
+	{
+		ph::VideoCapture vc(path, opts);
+		vector<float> samples;
+		process_pulling(vc, [&]{
+				float buf[1024];
+				int n;
+				while ((n = vc.PullAudioSamples(buf, 1024)) > 0)
+					samples.insert(samples.end(), buf, buf + n);
+			});
+		ph::AudioFingerprinter fingerprinter(vc.GetAudioSampleRate());
+		fingerprinter.Add(samples.data(), (int)samples.size(), expected);
+	}
+
+	opts.flag |= PHCAPTURE_AUDIOFPONLY_FLAG;
+	ph::VideoCapture vc(path, opts);
+	vector<ph::AudioFingerprint> fps;
+	int samples_rc = 0;
+	process_pulling(vc, [&]{
+			ph::AudioFingerprint fp;
+			while (vc.PullAudioFingerprint(fp) == 0)
+				fps.push_back(fp);
+			float buf[16];
+			samples_rc = vc.PullAudioSamples(buf, 16);
+		});
+	if (samples_rc != 0){
+		cout << "fingerprint: FAIL samples buffered in fingerprint only mode" << endl;
+		return false;
+	}
+	// pts start where the stream does
+	size_t n = (expected.size() < fps.size()) ? expected.size() : fps.size();
+	for (size_t i=0;i<n;i++){
+		if (fps[i].bits != expected[i].bits
+			|| fps[i].pts - fps[0].pts != expected[i].pts - expected[0].pts){
+			cout << "fingerprint: FAIL record " << i << " differs" << endl;
+			return false;
+		}
+	}
+	if (fps.size() != expected.size() || expected.empty()){
+		cout << "fingerprint: FAIL " << fps.size() << " records, expected " << expected.size() << endl;
+		return false;
+	}
+	cout << "fingerprint: ok, " << fps.size() << " records" << endl;
+	return true;
+}
+
+/* luma views hold the serial frames' pixels, also after the capture is closed */
+static bool test_view(const string &path, const vector<FrameInfo> &frames){
+	vector<ph::FrameView> views;
+	bool chroma = false;
+	{
+		ph::VideoCapture vc(path, video_options());
+		process_pulling(vc, [&]{
+				ph::FrameView view;
+				while (vc.PullFrameView(view, PHPLANE_Y) == 0){
+					chroma = chroma || view.Plane(1).data != NULL || view.Plane(2).data != NULL;
+					views.push_back(view);
+				}
+			});
+	}
+	if (chroma){
+		cout << "view: FAIL chroma planes in a luma view" << endl;
+		return false;
+	}
+	vector<FrameInfo> got;
+	for (const ph::FrameView &view : views){
+		const ph::PlaneView &y = view.Plane(0);
+		FrameInfo info = FrameInfo();
+		info.pts = view.Pts();
+		info.luma = plane_sum(y.data, y.linesize, y.width, y.height);
+		got.push_back(info);
+	}
+	return same_frames("view", frames, got);
+}
+
+/* crop margins cut exactly those pixels from the source frames; scale keeps the aspect */
+static bool test_crop(const string &path, const vector<int64_t> &serial){
+	const int tm = 3, bm = 5, lm = 7, rm = 9;    // odd, so not rounded to the chroma
+	ph::CaptureOptions opts = video_options();
+	opts.pix_fmt = PHPIXFMT_SOURCE;
+	vector<FrameInfo> expected;
+	{
+		ph::VideoCapture vc(path, opts);
+		process_pulling(vc, [&]{
+				ph::VideoFrame frame;
+				while (vc.PullVideoFrame(frame) == 0){
+					FrameInfo info = frame_info(frame.get());
+					info.width = frame->width - lm - rm;
+					info.height = frame->height - tm - bm;
+					info.luma = plane_sum(frame->data[0] + tm*frame->linesize[0] + lm, frame->linesize[0],
+										  info.width, info.height);
+					expected.push_back(info);
+				}
+			});
+	}
+	opts.top_m = tm;
+	opts.bottom_m = bm;
+	opts.left_m = lm;
+	opts.right_m = rm;
+	vector<FrameInfo> cropped = captured_frames(path, opts);
+	for (const FrameInfo &f : cropped){
+		if (expected.empty() || f.width != expected[0].width || f.height != expected[0].height){
+			cout << "crop: FAIL " << f.width << "x" << f.height << " frame" << endl;
+			return false;
+		}
+	}
+	bool ok = same_frames("crop", expected, cropped);
+
+	ph::CaptureOptions scale_opts = video_options();
+	scale_opts.width = 160;
+	vector<FrameInfo> scaled = captured_frames(path, scale_opts);
+	vector<int64_t> pts;
+	for (const FrameInfo &f : scaled){
+		if (f.width != 160 || f.height != 120){
+			cout << "scale: FAIL " << f.width << "x" << f.height << " frame, expected 160x120" << endl;
+			return false;
+		}
+		pts.push_back(f.pts);
+	}
+	return same_pts("scale", serial, pts) && ok;
+}
+
+/* PHPIXFMT_GRAY8 gives the luma of the yuv444p frames alone */
+static bool test_gray(const string &path, const vector<FrameInfo> &frames){
+	ph::CaptureOptions opts = video_options();
+	opts.pix_fmt = PHPIXFMT_GRAY8;
+	vector<FrameInfo> gray = captured_frames(path, opts);
+	for (const FrameInfo &f : gray){
+		if (f.format != AV_PIX_FMT_GRAY8){
+			cout << "gray: FAIL frame format " << f.format << endl;
+			return false;
+		}
+	}
+	return same_frames("gray", frames, gray);
+}
+
+/* PHDEINT_AUTO deinterlaces the interlaced stream as PHDEINT_ON does, and
+ * leaves the progressive one as PHDEINT_OFF does */
+static bool test_deinterlace(const string &path, const string &interlaced_path, const vector<FrameInfo> &frames){
+	ph::CaptureOptions opts = video_options();
+	opts.deinterlace = PHDEINT_OFF;
+	bool ok = same_frames("deinterlace off", frames, captured_frames(path, opts));
+
+	vector<FrameInfo> off = captured_frames(interlaced_path, opts);
+	opts.deinterlace = PHDEINT_ON;
+	vector<FrameInfo> on = captured_frames(interlaced_path, opts);
+	opts.deinterlace = PHDEINT_AUTO;
+	vector<FrameInfo> autodeint = captured_frames(interlaced_path, opts);
+	ok = same_frames("deinterlace auto", on, autodeint) && ok;
+
+	bool changed = false;
+	for (size_t i=0;i<off.size() && i<on.size();i++)
+		changed = changed || off[i].luma != on[i].luma;
+	if (!changed){
+		cout << "deinterlace on: FAIL interlaced frames unchanged" << endl;
+		return false;
+	}
+	cout << "deinterlace on: ok" << endl;
+	return ok;
+}
+
+/* GetStats() adds up what a run read and queued, and may be polled while it runs */
+static bool test_stats(const string &path, const vector<int64_t> &serial){
+	ph::VideoCapture vc(path, video_options());
+	atomic_bool done(false);
+	atomic_bool overfull(false);
+	int polls = 0;
+	thread monitor([&]{
+			while (!done.load()){
+				ph::CaptureStats stats = vc.GetStats();
+				if (stats.video_queue_depth > stats.video_queue_capacity)
+					overfull = true;
+				polls++;
+				this_thread::sleep_for(chrono::milliseconds(1));
+			}
+		});
+	vector<int64_t> pts = pulled_pts(vc, [&]{ vc.Process(); });
+	done = true;
+	monitor.join();
+
+	ph::CaptureStats stats = vc.GetStats();
+	struct stat st;
+	off_t file_size = (stat(path.c_str(), &st) == 0) ? st.st_size : 0;
+	const char *fail = NULL;
+	if (pts.size() != serial.size())
+		fail = "frames pulled";
+	else if (stats.video_frames != serial.size() || stats.video_frames_dropped != 0)
+		fail = "video_frames";
+	else if (stats.packets_read < serial.size() || stats.bytes_read == 0
+			 || stats.bytes_read > (uint64_t)file_size)
+		fail = "packets_read/bytes_read";
+	else if (stats.read_secs <= 0 || stats.video_decode_secs <= 0 || stats.video_filter_secs <= 0)
+		fail = "stage times";   // yuv444p output, so the filter graph runs
+	else if (stats.video_queue_depth != 0 || stats.video_queue_capacity <= 0 || overfull)
+		fail = "video queue depth";
+	if (fail != NULL){
+		cout << "stats: FAIL " << fail << endl;
+		return false;
+	}
+	cout << "stats: ok, " << stats.packets_read << " packets, " << stats.bytes_read
+		 << " bytes, polled " << polls << " times" << endl;
+	return true;
+}
+
+/* only packets of the captured streams are read; the demuxer skips the others */
+static bool test_discard(const string &path, const vector<int64_t> &serial){
+	const int flags[3] = { PHCAPTURE_VIDEO_FLAG, PHCAPTURE_AUDIO_FLAG, PHCAPTURE_VIDEOAUDIO_FLAG };
+	uint64_t packets[3];
+	for (int i=0;i<3;i++){
+		ph::CaptureOptions opts;
+		opts.flag = flags[i];
+		ph::VideoCapture vc(path, opts);
+		process_pulling(vc, [&]{
+				AVFrame *frame;
+				while (vc.PullPooledVideoFrame(frame) == 0)
+					vc.ReleaseVideoFrame(frame);
+				float buf[1024];
+				while (vc.PullAudioSamples(buf, 1024) > 0)
+					continue;
+			});
+		packets[i] = vc.GetStats().packets_read;
+	}
+	// a packet per frame in the fixture
+	if (packets[0] != serial.size() || packets[0] + packets[1] != packets[2]){
+		cout << "discard: FAIL " << packets[0] << " video, " << packets[1] << " audio, "
+			 << packets[2] << " packets for both" << endl;
+		return false;
+	}
+	cout << "discard: ok, " << packets[0] << " video and " << packets[1] << " audio packets" << endl;
+	return true;
+}
+
+/* run Process() with nobody pulling; false if it is still running after secs */
+static bool process_unattended(ph::VideoCapture &vc, function<void()> after_fill, int secs){
+	promise<void> done;
+	future<void> finished = done.get_future();
+	thread producer([&]{
+			try {
+				vc.Process();
+			} catch (exception &ex){
+				cout << "process: " << ex.what() << endl;
+			}
+			done.set_value();
+		});
+	this_thread::sleep_for(chrono::milliseconds(500));
+	after_fill();
+	if (finished.wait_for(chrono::seconds(secs)) != future_status::ready){
+		producer.detach();
+		return false;
+	}
+	producer.join();
+	return true;
+}
+
+/* PHQUEUE_BLOCK waits on a full pool until Stop(); drop policies never wait,
+ * but PHQUEUE_DROP_NONKEY does for key frames */
+static bool test_queue_policy(const string &path, const vector<FrameInfo> &frames){
+	vector<int64_t> serial;
+	for (const FrameInfo &f : frames)
+		serial.push_back(f.pts);
+	bool ok = true;
+	{
+		ph::VideoCapture vc(path, video_options());
+		bool waiting = false;
+		bool stopped = process_unattended(vc, [&]{
+				waiting = vc.GetStats().video_queue_depth > 0;
+				vc.Stop();
+			}, 5);
+		if (!stopped){
+			// still blocked; vc can not be closed under it
+			cout << "block: FAIL Stop() did not end Process()" << endl;
+			_exit(1);
+		}
+		if (!waiting){
+			cout << "block: FAIL nothing queued" << endl;
+			ok = false;
+		} else {
+			cout << "block: ok, Stop() ended Process()" << endl;
+		}
+	}
+	{
+		ph::CaptureOptions opts = video_options();
+		opts.video_queue_policy = PHQUEUE_DROP_NEWEST;
+		ph::VideoCapture vc(path, opts);
+		if (!process_unattended(vc, []{}, 10)){
+			cout << "drop newest: FAIL Process() waited" << endl;
+			_exit(1);
+		}
+		ph::CaptureStats stats = vc.GetStats();
+		uint64_t total = stats.video_frames + stats.video_frames_dropped;
+		if (stats.video_frames_dropped == 0 || total != serial.size()){
+			cout << "drop newest: FAIL " << stats.video_frames << " queued, "
+				 << stats.video_frames_dropped << " dropped" << endl;
+			ok = false;
+		} else {
+			cout << "drop newest: ok, " << stats.video_frames_dropped << " dropped" << endl;
+		}
+	}
+	{
+		// the queue ends up holding the last frames
+		ph::CaptureOptions opts = video_options();
+		opts.video_queue_policy = PHQUEUE_DROP_OLDEST;
+		ph::VideoCapture vc(path, opts);
+		if (!process_unattended(vc, []{}, 10)){
+			cout << "drop oldest: FAIL Process() waited" << endl;
+			_exit(1);
+		}
+		vector<int64_t> kept;
+		AVFrame *frame;
+		while (vc.PullPooledVideoFrame(frame, 0) == 0){
+			kept.push_back(frame->pts);
+			vc.ReleaseVideoFrame(frame);
+		}
+		ph::CaptureStats stats = vc.GetStats();
+		if (kept.empty() || kept.size() >= serial.size()
+			|| stats.video_frames_dropped != serial.size() - kept.size()){
+			cout << "drop oldest: FAIL " << kept.size() << " kept, "
+				 << stats.video_frames_dropped << " dropped" << endl;
+			ok = false;
+		} else {
+			vector<int64_t> last(serial.end() - kept.size(), serial.end());
+			ok = same_pts("drop oldest", last, kept) && ok;
+		}
+	}
+	{
+		// a slow consumer loses non-key frames only
+		ph::CaptureOptions opts = video_options();
+		opts.video_queue_policy = PHQUEUE_DROP_NONKEY;
+		ph::VideoCapture vc(path, opts);
+		vector<FrameInfo> pulled;
+		process_pulling(vc, [&]{
+				ph::VideoFrame frame;
+				while (vc.PullVideoFrame(frame) == 0){
+					pulled.push_back(frame_info(frame.get()));
+					this_thread::sleep_for(chrono::milliseconds(10));
+				}
+			});
+		size_t j = 0;
+		bool lost_key = false;
+		for (const FrameInfo &f : frames){
+			if (j < pulled.size() && pulled[j].pts == f.pts)
+				j++;
+			else if (f.key_frame)
+				lost_key = true;
+		}
+		ph::CaptureStats stats = vc.GetStats();
+		if (j != pulled.size() || lost_key || stats.video_frames_dropped == 0
+			|| stats.video_frames_dropped != frames.size() - pulled.size()){
+			cout << "drop nonkey: FAIL " << pulled.size() << " pulled, "
+				 << stats.video_frames_dropped << " dropped"
+				 << ((lost_key) ? ", key frame lost" : "") << endl;
+			ok = false;
+		} else {
+			cout << "drop nonkey: ok, " << stats.video_frames_dropped << " dropped" << endl;
+		}
+	}
+	return ok;
+}
+
+/* b-frames and a 1 sec gop; mpeg4 if there is no h264 encoder */
+static string test_fixture(const string &dir, bool interlaced, double secs){
+	FixtureSpec specs[] = { { "h264", AV_CODEC_ID_H264, 320, 240, interlaced },
+							{ "mpeg4", AV_CODEC_ID_MPEG4, 320, 240, interlaced } };
+	for (const FixtureSpec &spec : specs){
+		string path = dir + "/test_" + fixture_name(spec) + ".mkv";
+		if (access(path.c_str(), R_OK) == 0 || make_fixture(spec, path, secs))
+			return path;
+	}
+	return string();
+}
+
+int main(int argc, char **argv){
+	string dir = (argc > 1) ? argv[1] : "testcapture-fixtures";
+	av_log_set_level(AV_LOG_ERROR);
+	if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST){
+		cout << "unable to create " << dir << endl;
+		return 1;
+	}
+
+	string path = test_fixture(dir, false, TestSecs);
+	string interlaced_path = test_fixture(dir, true, FixtureSecs);
+	if (path.empty() || interlaced_path.empty()){
+		cout << "unable to generate fixture" << endl;
+		return 1;
+	}
+	cout << "fixtures: " << path << ", " << interlaced_path << endl;
+
+	int failed = 0;
+	try {
+		vector<int64_t> serial = serial_pts(path);
+		cout << "serial: " << serial.size() << " frames" << endl;
+		if (serial.size() != (size_t)(TestSecs*FixtureRate)){
+			cout << "serial: FAIL expected " << (int)(TestSecs*FixtureRate) << " frames" << endl;
+			failed++;
+		}
+
+		vector<FrameInfo> frames = captured_frames(path);
+
+		if (!test_range(path, serial)) failed++;
+		if (!test_segmented(path, serial)) failed++;
+		if (!test_sync(path, serial)) failed++;
+		if (!test_pipelined(path, serial)) failed++;
+		if (!test_keyframe(path, frames)) failed++;
+		if (!test_extract(path, frames)) failed++;
+		if (!test_sources(path, frames)) failed++;
+		if (!test_hash(path, frames)) failed++;
+		if (!test_fingerprint(path)) failed++;
+		if (!test_view(path, frames)) failed++;
+		if (!test_crop(path, serial)) failed++;
+		if (!test_gray(path, frames)) failed++;
+		if (!test_deinterlace(path, interlaced_path, frames)) failed++;
+		if (!test_stats(path, serial)) failed++;
+		if (!test_discard(path, serial)) failed++;
+		if (!test_batched(path, serial)) failed++;
+		if (!test_queue_policy(path, frames)) failed++;
+	} catch (exception &ex){
+		cout << "error: " << ex.what() << endl;
+		failed++;
+	}
+
+	cout << ((failed) ? "FAILED" : "all ok") << endl;
+	return (failed) ? 1 : 0;
+}
@@ -26,46 +26,32 @@ SOFTWARE.
 
 #include <cstdlib>
 #include <iostream>
-#include <atomic>
 #include <thread>
-#include <mutex>
 #include <cassert>
 #include <cstdint>
-#include "circ_buf.h"
+#include "CircBuffer.hpp"
 
 using namespace std;
 
 const int CircBufferSize = 1024;  //size of circular buffer
 const int NumberSamples = 100000000; //print values 0 ... Max-1 in producer thread to circ buffer
 
-/** circular buffer type **/
-typedef struct circ_buf {
-	int16_t *samples;
-	atomic_ulong head;
-	atomic_ulong tail;
-} CircBuffer;
-
-mutex producer_mtx;
-mutex consumer_mtx;
+typedef ph::CircBuffer<int16_t> CircBuffer;
 
 int produce(CircBuffer *circbuffer, int n){
+	int16_t *local_buffer = new int16_t[n];
 	int16_t val = 0;
 	long count = 0;
 	while (count < NumberSamples){
-		producer_mtx.lock();
-		unsigned long head = circbuffer->head.load(memory_order_relaxed);
-		unsigned long tail = circbuffer->tail.load(memory_order_acquire);
-		if ((int)CIRC_SPACE(head, tail, CircBufferSize) >= n){
-			for (int i=0;i<n;i++){
-				circbuffer->samples[head] = val++;
-				head = (head + 1) & (CircBufferSize - 1);
-				count++;
-			}
+		int len = (NumberSamples - count < n) ? (int)(NumberSamples - count) : n;
+		for (int i=0;i<len;i++){
+			local_buffer[i] = val++;
 		}
-		circbuffer->head.store(head, memory_order_release);
-		producer_mtx.unlock();
+		count += circbuffer->Write(local_buffer, len);
 	}
+	circbuffer->Close();
 	cout << "produce: " << count << endl;
+	delete[] local_buffer;
 	return 0;
 }
 
@@ -73,34 +59,66 @@ int consume(CircBuffer *circbuffer, int n){
 	int16_t *local_buffer = new int16_t[n];
 	long count = 0;
 	int16_t val = 0;
-	while (count < NumberSamples){
-		consumer_mtx.lock();
-		unsigned long head = circbuffer->head.load(memory_order_acquire);
-		unsigned long tail = circbuffer->tail.load(memory_order_relaxed);
-		if ((int)CIRC_CNT(head, tail, CircBufferSize) >= n){
-			for (int i=0;i<n;i++){
-				local_buffer[i] = circbuffer->samples[tail];
-				tail = (tail + 1) & (CircBufferSize - 1);
-				assert(val++ == local_buffer[i]);
-				count++;
-			}
-			circbuffer->tail.store(tail, memory_order_release);
+	unsigned long nread;
+	while ((nread = circbuffer->Read(local_buffer, n)) > 0){
+		for (int i=0;i<(int)nread;i++){
+			assert(val++ == local_buffer[i]);
+			count++;
 		}
-		consumer_mtx.unlock();
 	}
+	assert(count == NumberSamples);
 	cout << "consume: " << count << endl;
 	delete[] local_buffer;
 	return 0;
 }
 
+/* same check reading in place with Peek/Commit */
+int consume_peek(CircBuffer *circbuffer, int n){
+	ph::SampleSpan<int16_t> first, second;
+	long count = 0;
+	int16_t val = 0;
+	unsigned long nready;
+	while ((nready = circbuffer->Peek(first, second, n)) > 0){
+		assert(first.len + second.len == nready);
+		for (unsigned long i=0;i<first.len;i++)
+			assert(val++ == first.data[i]);
+		for (unsigned long i=0;i<second.len;i++)
+			assert(val++ == second.data[i]);
+		circbuffer->Commit(nready);
+		count += nready;
+	}
+	assert(count == NumberSamples);
+	cout << "consume_peek: " << count << endl;
+	return 0;
+}
+
+/* committing more than was peeked must not move tail past head */
+void test_overcommit(){
+	CircBuffer circbuffer(16);
+	ph::SampleSpan<int16_t> first, second;
+	int16_t vals[10];
+	for (int i=0;i<10;i++) vals[i] = (int16_t)i;
+
+	circbuffer.Write(vals, 10);
+	assert(circbuffer.Peek(first, second, 4) == 10);
+	assert(circbuffer.Commit(100) == 10);
+	assert(circbuffer.Count() == 0);
+
+	// ring still consistent: fresh samples read back in order, across the wrap
+	circbuffer.Write(vals, 10);
+	assert(circbuffer.Count() == 10);
+	int16_t out[10];
+	assert(circbuffer.Read(out, 10) == 10);
+	for (int i=0;i<10;i++)
+		assert(out[i] == i);
+	assert(circbuffer.Count() == 0);
+	cout << "overcommit: ok" << endl;
+}
 
 int main(int argc, char **argv){
 	cout << "main:test circ buffer" << endl;
 	
-	CircBuffer circbuffer;
-	circbuffer.samples = new int16_t[CircBufferSize];
-	circbuffer.head = 0;
-	circbuffer.tail = 0;
+	CircBuffer circbuffer(CircBufferSize);
 
 	cout << "main:start producer thread" << endl;
 	thread producer_thr(produce, &circbuffer, 250);
@@ -112,7 +130,15 @@ int main(int argc, char **argv){
 	producer_thr.join();
 	consumer_thr.join();
 
-	delete[] circbuffer.samples;
+	cout << "main:again, consumer peeks in place" << endl;
+	circbuffer.Reset();
+	thread producer2_thr(produce, &circbuffer, 250);
+	thread consumer2_thr(consume_peek, &circbuffer, 700);
+	producer2_thr.join();
+	consumer2_thr.join();
+
+	test_overcommit();
+
 	cout << "main:Done." << endl;
 	return 0;
 }
@@ -0,0 +1,98 @@
+/**
+
+MIT License
+
+Copyright (c) 2018 David G. Starkweather
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+**/
+
+#include <cstdlib>
+#include <iostream>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include "PHash.hpp"
+
+using namespace std;
+using namespace ph;
+
+const int Width = 643;     // odd sizes exercise the kernel tails
+const int Height = 361;
+const int LineSize = 672;
+
+static int hamming(uint64_t a, uint64_t b){
+	return __builtin_popcountll(a ^ b);
+}
+
+/* smooth gradient with a few blobs, plus optional noise */
+static void make_plane(vector<uint8_t> &plane, int seed, int noise){
+	srand(seed);
+	int cx = rand()%Width, cy = rand()%Height;
+	for (int y=0;y<Height;y++){
+		for (int x=0;x<Width;x++){
+			int dx = x - cx, dy = y - cy;
+			int val = (x*255)/Width/2 + ((dx*dx + dy*dy < 80*80) ? 120 : 0);
+			if (noise) val += rand()%(2*noise + 1) - noise;
+			plane[y*LineSize + x] = (uint8_t)((val < 0) ? 0 : (val > 255) ? 255 : val);
+		}
+	}
+}
+
+int main(int argc, char **argv){
+	cout << "main:test perceptual hash" << endl;
+
+	vector<uint8_t> plane(LineSize*Height), noisy(LineSize*Height), other(LineSize*Height);
+	make_plane(plane, 1, 0);
+	make_plane(noisy, 1, 8);
+	make_plane(other, 7, 0);
+
+	vector<const HashKernels*> kernels = GetAvailableHashKernels();
+	const HashKernels &ref = *kernels[0];
+	uint64_t ph_ref = PHash(plane.data(), LineSize, Width, Height, ref);
+	uint64_t bm_ref = BlockMeanHash(plane.data(), LineSize, Width, Height, ref);
+	cout << "c: phash = " << hex << ph_ref << " bmhash = " << bm_ref << dec << endl;
+
+	// every kernel set agrees with the scalar one
+	for (const HashKernels *k : kernels){
+		for (int n=0;n<100;n++)
+			assert(k->sum_u8(plane.data() + n, Width - n) == ref.sum_u8(plane.data() + n, Width - n));
+		uint64_t ph = PHash(plane.data(), LineSize, Width, Height, *k);
+		uint64_t bm = BlockMeanHash(plane.data(), LineSize, Width, Height, *k);
+		cout << k->name << ": phash distance = " << hamming(ph, ph_ref) << endl;
+		assert(hamming(ph, ph_ref) <= 2);  // float summation order differs
+		assert(bm == bm_ref);
+	}
+	cout << "default kernels: " << GetHashKernels().name << endl;
+
+	// similar images hash close, different images far
+	int d_noisy = hamming(ph_ref, PHash(noisy.data(), LineSize, Width, Height));
+	int d_other = hamming(ph_ref, PHash(other.data(), LineSize, Width, Height));
+	cout << "phash distance: noisy = " << d_noisy << " other = " << d_other << endl;
+	assert(d_noisy < d_other);
+
+	// tiny planes do not divide by zero
+	uint8_t pixel = 128;
+	PHash(&pixel, 1, 1, 1);
+	BlockMeanHash(&pixel, 1, 1, 1);
+
+	cout << "main:Done." << endl;
+	return 0;
+}